@@ -10,12 +10,13 @@ using namespace scarabnet;
 class Client {
 	public:
 		Client(const bool show_log = false);
+		Client(const HostConfig& config);
 		~Client() noexcept;
 
 		// Returns true if client is running
-		// inline bool isrunning() const noexcept {
-		// 	return this->running;
-		// }
+		inline bool isrunning() const noexcept {
+			return this->running;
+		}
 
 		// Returns true if client is connected to a server
 		inline bool isconnected() const noexcept {
@@ -29,48 +30,172 @@ class Client {
 		// Disconnects from the server
 		void disconnect() noexcept;
 
-		// Sends a packet to the server
-		void send(const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE) const noexcept;
+		// Sends a packet to the server, on one of HostConfig::channels
+		void send(const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE, const uint8 channel = 0) noexcept;
+
+		// Sends a packet built in place to the server
+		void send(PacketBuilder&& builder, const uint8 channel = 0) noexcept;
+
+		// Sends out queued packets right away, without waiting for the network thread's next wake up.
+		// With HostConfig::aggregate_size, also sends the packets aggregated since the last flush
+		void flush() noexcept;
+
+		// Services the host on the calling thread, for clients created with HostConfig::network_thread = false.
+		// Waits up to timeout for events and passes each one to handler(Event&&) directly,
+		// without going through the event queue.
+		// Returns the number of events handled
+		template <typename Rep, typename Period, typename F>
+		size_t service(const std::chrono::duration<Rep, Period>& timeout, F&& handler);
+
+		// Same as service, but keeps servicing until deadline
+		template <typename Clock, typename Duration, typename F>
+		size_t service_until(const std::chrono::time_point<Clock, Duration>& deadline, F&& handler);
+
+		// Counters of HostConfig::compress or HostConfig::compressor, all zero without compression.
+		// Safe to call from any thread
+		CompressionStats compression_stats() const noexcept;
+
+		// Sets a handler invoked in place on the thread servicing the host.
+		// Events it consumes are not pushed to the event queue. Set it before connect(), nullptr removes it
+		void set_handler(EventHandler* handler) noexcept;
 
 		// Returns true if an event was processed, false otherwhise
 		bool poll_event(Event& event) noexcept;
 
+		// Moves up to events.size() queued events into the buffer.
+		// Returns the number of events written
+		size_t poll_events(std::span<Event> events) noexcept;
+
+		// Appends every queued event to the vector.
+		// Returns the number of events appended
+		size_t drain_events(std::vector<Event>& events);
+
+		// Waits up to timeout for an event, sleeping instead of spinning.
+		// Returns true if an event was processed
+		template <typename Rep, typename Period>
+		bool wait_event(Event& event, const std::chrono::duration<Rep, Period>& timeout);
+
+		// Waits up to timeout for events, then moves up to events.size() of them into the buffer.
+		// Returns the number of events written
+		template <typename Rep, typename Period>
+		size_t wait_events(std::span<Event> events, const std::chrono::duration<Rep, Period>& timeout);
+
+		// Returns a file descriptor that is readable while there are events to poll,
+		// to wait on the client from an external epoll/poll loop.
+		// Created on first call. Not available on Windows
+		int event_fd();
+
 	private:
 		// Listen to events and push to vector of events
 		void network_thread_loop(); // Loop of thread
+
+		// One pass over the host: hands queued commands to ENet, then passes every ready event to emit.
+		// If nothing was ready, waits up to timeout milliseconds for more
+		template <typename F>
+		size_t service_once(const uint32 timeout, F&& emit);
+
+		// Passes every event ENet has ready to emit
+		template <typename F>
+		size_t dispatch_ready(F&& emit);
+
+		// Turns an ENet event into an Event passed to emit
+		template <typename F>
+		void dispatch(ENetEvent& event, F&& emit);
 		// Stop network thread
 		void stop_network() noexcept;
 
+		// Queue a command for the network thread, waiting for room if the queue is full
+		void push_command(Command&& command) noexcept;
+
+		// Queue a Send command for an ENet packet
+		void push_send(const uint8 channel, ENetPacket* packet) noexcept;
+
+		// Hand queued commands to ENet. Only called by the thread servicing the host
+		void process_commands() noexcept;
+
+		// Hands a packet to ENet, destroying it if that fails
+		void send_to(ENetPeer* peer, const uint8 channel, ENetPacket* packet) noexcept;
+
+		// Send the aggregated bundles, if aggregating
+		void flush_bundles() noexcept;
+
+		// Push an event to the application, waiting for room if the queue is full
+		void push_event(Event&& event) noexcept;
+
+		// Clear event_fd() readiness once the application took every event
+		void reset_event_fd() noexcept;
+
 		ENetHost* host = nullptr;
 		ENetPeer* peer = nullptr;
 
+		HostConfig config;
 		bool show_log; // Debug
-		TSQueue<Event> events;
+		// Optional in place event handling, not owned
+		EventHandler* handler = nullptr;
+		// Network thread produces, application thread consumes
+		SPSCQueue<Event> events;
+		// Wakes the application thread blocked in wait_event
+		EventSignal signal;
+		// Application threads produce, network thread consumes
+		MPSCQueue<Command> commands;
+		// Interrupts the network thread's wait when a command is queued
+		Waker waker;
+		// Bundles sent packets until flush(), only with HostConfig::aggregate_size.
+		// Only used by the thread servicing the host
+		std::unique_ptr<PacketAggregator> aggregator;
+		// Compresses the host's datagrams, only with HostConfig::compress or HostConfig::compressor
+		std::unique_ptr<HostCompressor> compressor;
 
 		// Thread
 		std::thread thread;
 		std::atomic<bool> running   = false;
 		std::atomic<bool> connected = false;
 		// atomic avoids data races
+		// Thread currently servicing the host, network thread or service() caller
+		std::atomic<std::thread::id> service_thread;
 };
 
 
-inline Client::Client(const bool show_log) : show_log(show_log) {
-	if(enet_initialize() != 0) {
+inline Client::Client(const bool show_log)
+	: Client(HostConfig { .show_log = show_log }) {}
+
+inline Client::Client(const HostConfig& config)
+	: config(config), show_log(config.show_log) {
+	if(initialize_enet() != 0) {
 		throw std::runtime_error("Failed to initialize ENet");
 	}
 
 	this->host = enet_host_create(
 		NULL, // Client host
 		1, // Allow 1 outgoing connection
-		2, // Allow up to 2 channels to be used (0 and 1)
+		config.channels, // Channels 0 to channels - 1, 0 allows the maximum
 		0, // Assume any amount of incoming bandwidth
 		0  // Assume any amount of outgoing bandwidth
 	);
 
 	if(this->host == NULL) {
+		deinitialize_enet();
 		throw std::runtime_error("Failed to create ENet client host");
 	}
+
+	// io_uring takes over the socket where available, batching is the next best thing
+	if(config.io_uring_entries > 0 && enet_host_socket_uring(this->host, config.io_uring_entries) < 0) {
+		LOG_SERVER("io_uring unavailable, using the socket syscalls");
+	}
+	if(config.socket_batch > 0 && this->host->socketUring == NULL
+		&& enet_host_socket_batch(this->host, config.socket_batch) < 0) {
+		LOG_SERVER("Socket batching unavailable, using one syscall per datagram");
+	}
+
+	if(config.aggregate_size > 0) {
+		// Bundles that don't fit in a datagram would be fragmented
+		const size_t limit = std::min<size_t>(config.aggregate_size, PacketAggregator::unfragmented_size(this->host));
+		this->aggregator = std::make_unique<PacketAggregator>(limit, this->host->peerCount);
+	}
+	if(config.compress || config.compressor) {
+		this->compressor = std::make_unique<HostCompressor>(config.compressor);
+		this->compressor->attach(this->host);
+	}
 }
 
 inline Client::~Client() noexcept {
@@ -80,6 +205,11 @@ inline Client::~Client() noexcept {
 	}
 	this->stop_network(); // Stop thread
 
+	// Thread is gone, hand what it didn't get to (like the disconnect) to ENet and send it out
+	this->aggregator.reset();
+	this->process_commands();
+	enet_host_flush(this->host);
+
 	// Reset peer
 	if(this->peer != nullptr) {
 		enet_peer_reset(peer);
@@ -91,7 +221,7 @@ inline Client::~Client() noexcept {
 		enet_host_destroy(this->host);
 	}
 
-	enet_deinitialize();
+	deinitialize_enet();
 
 	// Peer was stopped inside Disconnect event
 }
@@ -105,8 +235,8 @@ inline void Client::connect(const std::string& ipaddress, const uint16 port) {
 	ENetAddress address = { 0 };
 	address.port = port;
 	enet_address_set_host(&address, ipaddress.c_str());
-	// Allocating the two channels 0 and 1
-	this->peer = enet_host_connect(this->host, &address, 2, 0);
+	// The server may allow fewer, the connection then uses the smaller count
+	this->peer = enet_host_connect(this->host, &address, this->host->channelLimit, 0);
 
 	if(this->peer == NULL) {
 		throw std::runtime_error("Failed to create ENet peer for connection");
@@ -115,43 +245,176 @@ inline void Client::connect(const std::string& ipaddress, const uint16 port) {
 	LOG_SERVER("Connection attempt started to " << ipaddress << ":" << port);
 
 	// Start the network thread to handle the connection result and future events
+	// Otherwise the application services the host with service()
 	this->running = true;
-	this->thread  = std::thread(&Client::network_thread_loop, this);
+	if(this->config.network_thread) {
+		this->thread = std::thread(&Client::network_thread_loop, this);
+	}
 }
 
 inline void Client::disconnect() noexcept {
 	if(!this->isconnected()) {
 		return;
 	}
-	enet_peer_disconnect(this->peer, 0); // Trigger disconnect event
+	// Trigger disconnect event
+	this->push_command({ .type = Command::Type::Disconnect });
 	LOG_SERVER("Disconnecting from server");
 
 	// Thread disconnect will be processed in the network thread
 }
 
-inline void Client::send(const Packet& packet, const PacketFlag flag) const noexcept {
+inline void Client::send(const Packet& packet, const PacketFlag flag, const uint8 channel) noexcept {
 	if(!this->connected) {
 		LOG_SERVER("Not connected to send packet");
 		return;
 	}
 
-	const std::vector<uint8> buffer = PacketHelper::serialize_packet(packet);
-	ENetPacket* epacket = enet_packet_create(
-		buffer.data(),
-		buffer.size(),
-		(ENetPacketFlag)flag
-	);
-	enet_peer_send(this->peer, 0, epacket);
+	LOG_SERVER("Sending packet of size " << packet.size() << "...");
+
+	this->push_send(channel, PacketHelper::create_enet_packet(packet, flag));
+}
 
-	LOG_SERVER("Sending packet of size " << packet.data.size() << "...");
+inline void Client::send(PacketBuilder&& builder, const uint8 channel) noexcept {
+	if(!this->connected) {
+		LOG_SERVER("Not connected to send packet");
+		return;
+	}
+
+	LOG_SERVER("Sending packet of size " << builder.size() << "...");
+	this->push_send(channel, builder.release());
+}
+
+inline void Client::flush() noexcept {
+	if(!this->running) {
+		return;
+	}
+	this->push_command({ .type = Command::Type::Flush });
+}
+
+inline void Client::push_command(Command&& command) noexcept {
+	// Allocation failed
+	if(command.type == Command::Type::Send && command.packet == NULL) {
+		LOG_SERVER("Allocation failed while creating packet");
+		return;
+	}
+
+	// Queue is bounded, hold the caller until the network thread catches up
+	while(!this->commands.push_back(std::move(command))) {
+		if(!this->running) {
+			enet_packet_destroy(command.packet);
+			return;
+		}
+		// Sending from the thread servicing the host (e.g. inside a handler), nobody else will drain the queue
+		if(std::this_thread::get_id() == this->service_thread.load(std::memory_order_relaxed)) {
+			this->process_commands();
+			continue;
+		}
+		std::this_thread::yield();
+	}
+	this->waker.notify();
+}
+
+inline void Client::push_send(const uint8 channel, ENetPacket* packet) noexcept {
+	this->push_command({ .type = Command::Type::Send, .channel = channel, .packet = packet });
+}
+
+inline void Client::process_commands() noexcept {
+	Command command;
+	while(this->commands.pop_front(command)) {
+		switch(command.type) {
+			case Command::Type::Send: {
+				if(this->peer == nullptr) {
+					enet_packet_destroy(command.packet);
+					break;
+				}
+				// Bundled until the next flush when aggregating
+				if(this->aggregator) {
+					this->aggregator->append(this->peer, command.channel, command.packet, [this](ENetPeer* target, const uint8 channel, ENetPacket* packet) {
+						this->send_to(target, channel, packet);
+					});
+					break;
+				}
+				this->send_to(this->peer, command.channel, command.packet);
+				break;
+			}
+
+			case Command::Type::Disconnect: {
+				if(this->peer != nullptr) {
+					// What was sent before disconnecting goes out first
+					this->flush_bundles();
+					enet_peer_disconnect(this->peer, 0);
+				}
+				break;
+			}
+
+			case Command::Type::Flush: {
+				this->flush_bundles();
+				enet_host_flush(this->host);
+				break;
+			}
+
+			default:
+				enet_packet_destroy(command.packet);
+				break;
+		}
+	}
 }
 
 inline bool Client::poll_event(Event& event) noexcept {
-	if(this->events.empty()) {
-		return false;
+	const bool polled = this->events.pop_front(event);
+	this->reset_event_fd();
+	return polled;
+}
+
+inline size_t Client::poll_events(std::span<Event> events) noexcept {
+	size_t i = 0;
+	const size_t polled = this->events.pop_bulk(events.size(), [&](Event&& event) {
+		events[i++] = std::move(event);
+	});
+	this->reset_event_fd();
+	return polled;
+}
+
+inline size_t Client::drain_events(std::vector<Event>& events) {
+	events.reserve(events.size() + this->events.count());
+	const size_t polled = this->events.pop_bulk(SIZE_MAX, [&](Event&& event) {
+		events.push_back(std::move(event));
+	});
+	this->reset_event_fd();
+	return polled;
+}
+
+template <typename Rep, typename Period>
+inline bool Client::wait_event(Event& event, const std::chrono::duration<Rep, Period>& timeout) {
+	if(this->poll_event(event)) {
+		return true;
 	}
-	event = this->events.pop_front();
-	return true;
+
+	// Also wake up if the network thread stops, no more events will come
+	this->signal.wait_until(std::chrono::steady_clock::now() + timeout, [this]() {
+		return !this->events.empty() || !this->running;
+	});
+	return this->poll_event(event);
+}
+
+template <typename Rep, typename Period>
+inline size_t Client::wait_events(std::span<Event> events, const std::chrono::duration<Rep, Period>& timeout) {
+	this->signal.wait_until(std::chrono::steady_clock::now() + timeout, [this]() {
+		return !this->events.empty() || !this->running;
+	});
+	return this->poll_events(events);
+}
+
+inline int Client::event_fd() {
+	return this->signal.fd([this]() {
+		return !this->events.empty();
+	});
+}
+
+inline void Client::reset_event_fd() noexcept {
+	this->signal.reset_fd([this]() {
+		return !this->events.empty();
+	});
 }
 
 
@@ -164,57 +427,171 @@ inline void Client::stop_network() noexcept {
 	// }
 
 	this->running = false;
+	this->waker.notify(); // Don't wait out the service timeout
+	this->signal.notify(); // Release threads blocked in wait_event
 	if(this->thread.joinable()) {
 		this->thread.join();
 	}
 }
 
+inline void Client::send_to(ENetPeer* peer, const uint8 channel, ENetPacket* packet) noexcept {
+	if(packet == NULL) {
+		LOG_SERVER("Allocation failed while creating packet");
+		return;
+	}
+	// Fails if the channel is out of range
+	if(enet_peer_send(peer, channel, packet) < 0) {
+		enet_packet_destroy(packet); // Clean up on failure
+		LOG_SERVER("Failed to send packet on channel " << (int)channel);
+	}
+}
+
+inline void Client::flush_bundles() noexcept {
+	if(!this->aggregator) {
+		return;
+	}
+	this->aggregator->flush([this](ENetPeer* target, const uint8 channel, ENetPacket* packet) {
+		this->send_to(target, channel, packet);
+	});
+}
+
+inline void Client::push_event(Event&& event) noexcept {
+	// Queue is bounded, hold the network thread until the application catches up
+	while(!this->events.push_back(std::move(event))) {
+		if(!this->running) {
+			return;
+		}
+		// Keep sends flowing, the application may be waiting on them before polling
+		this->process_commands();
+		std::this_thread::yield();
+	}
+	this->signal.notify();
+}
+
+inline CompressionStats Client::compression_stats() const noexcept {
+	return this->compressor ? this->compressor->stats() : CompressionStats {};
+}
+
+inline void Client::set_handler(EventHandler* handler) noexcept {
+	this->handler = handler;
+}
+
+template <typename Rep, typename Period, typename F>
+inline size_t Client::service(const std::chrono::duration<Rep, Period>& timeout, F&& handler) {
+	if(!this->running || this->thread.joinable()) {
+		LOG_SERVER("service() needs a connecting client without a network thread");
+		return 0;
+	}
+
+	this->service_thread = std::this_thread::get_id();
+	return this->service_once((uint32)std::chrono::ceil<std::chrono::milliseconds>(timeout).count(), handler);
+}
+
+template <typename Clock, typename Duration, typename F>
+inline size_t Client::service_until(const std::chrono::time_point<Clock, Duration>& deadline, F&& handler) {
+	if(!this->running || this->thread.joinable()) {
+		LOG_SERVER("service_until() needs a connecting client without a network thread");
+		return 0;
+	}
+
+	this->service_thread = std::this_thread::get_id();
+	size_t count = 0;
+	do {
+		const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+		count += this->service_once((uint32)std::max<int64_t>(remaining.count(), 0), handler);
+	} while(this->running && Clock::now() < deadline);
+	return count;
+}
+
 inline void Client::network_thread_loop() {
+	this->service_thread = std::this_thread::get_id();
 	while(this->running) {
-		ENetEvent event;
-		// Wait 5ms for event
-		while(enet_host_service(this->host, &event, 5) > 0) {
-			// Peer ID of 0 represent the server connection
-			const uint32 serverid = 0;
-
-			switch (event.type) {
-				case ENET_EVENT_TYPE_CONNECT: {
-					this->connected = true;
-					this->events.push_back({ .peer_id = serverid, .type = EventType::Connect });
-					LOG_SERVER("Connection successful!");
-					break;
-				}
-					
-				case ENET_EVENT_TYPE_RECEIVE: {
-					LOG_SERVER("Packet received from server");
-
-					// Create an event with data inside
-					this->events.push_back({
-						.peer_id = serverid,
-						.type    = EventType::Receive,
-						.packet  = PacketHelper::deserialize_packet(event.packet->data, event.packet->dataLength)
-					});
+		this->service_once(this->config.service_timeout, [this](Event&& event) {
+			this->push_event(std::move(event));
+		});
+	}
+}
 
-					// This data was copied to the packet
-					// which was moved to the queue
-					enet_packet_destroy(event.packet);
-					break;
-				}
-				case ENET_EVENT_TYPE_DISCONNECT:
-				case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
-					// Since is disconnected, the network thread's job can stop
-					this->running = false;
-					this->connected = false;
-					// Push event
-					this->events.push_back({ .peer_id = serverid, .type = EventType::Disconnect });
-
-					LOG_SERVER("Disconnected from server");
-					break;
-				}
+template <typename F>
+inline size_t Client::service_once(const uint32 timeout, F&& emit) {
+	// Hand queued sends to ENet, so they go out in this service call
+	this->process_commands();
 
-				default:
-					break;
+	size_t count = this->dispatch_ready(emit);
+	if(count == 0 && timeout > 0) {
+		// Nothing ready, sleep until a datagram arrives, a command is queued or the timeout passes
+		this->waker.wait(enet_host_wait_socket(this->host), timeout, [this]() {
+			return !this->commands.empty() || enet_host_socket_pending(this->host);
+		});
+
+		this->process_commands();
+		count = this->dispatch_ready(emit);
+	}
+	return count;
+}
+
+template <typename F>
+inline size_t Client::dispatch_ready(F&& emit) {
+	size_t count = 0;
+	ENetEvent event;
+	while(enet_host_service(this->host, &event, 0) > 0) {
+		this->dispatch(event, emit);
+		count++;
+	}
+	return count;
+}
+
+template <typename F>
+inline void Client::dispatch(ENetEvent& event, F&& emit) {
+	// Peer ID of 0 represent the server connection
+	const uint32 serverid = 0;
+
+	switch (event.type) {
+		case ENET_EVENT_TYPE_CONNECT: {
+			this->connected = true;
+			if(!this->handler || !this->handler->on_connect(serverid)) {
+				emit(Event { .peer_id = serverid, .type = EventType::Connect });
 			}
+			LOG_SERVER("Connection successful!");
+			break;
 		}
+
+		case ENET_EVENT_TYPE_RECEIVE: {
+			LOG_SERVER("Packet received from server");
+
+			// Only aggregating hosts expect bundles, elsewhere BUNDLE_TYPE is a plain header type
+			if(this->aggregator && PacketHelper::receive_bundle(this->handler, serverid, event.channelID, event.packet, emit)) {
+				break;
+			}
+			if(PacketHelper::handle_packet(this->handler, serverid, event.packet)) {
+				break;
+			}
+
+			// Create an event with data inside
+			Event received = { .peer_id = serverid, .type = EventType::Receive, .channel = event.channelID };
+			PacketHelper::receive_packet(received, event.packet, this->config.zero_copy);
+			emit(std::move(received));
+			break;
+		}
+
+		case ENET_EVENT_TYPE_DISCONNECT:
+		case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
+			this->connected = false;
+			if(this->aggregator) {
+				this->aggregator->discard(event.peer);
+			}
+			// Push event before stopping, so it's not dropped on a full queue
+			if(!this->handler || !this->handler->on_disconnect(serverid)) {
+				emit(Event { .peer_id = serverid, .type = EventType::Disconnect });
+			}
+			// Since is disconnected, the network thread's job can stop
+			this->running = false;
+
+			LOG_SERVER("Disconnected from server");
+			break;
+		}
+
+		default:
+			break;
 	}
 }
@@ -1,22 +1,54 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <deque>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <utility>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <iostream>
 #include <iomanip>
 #include <thread>
 #include <atomic>
+#include <bit>
+#include <cmath>
 #include <stdexcept>
 
+// Large server mode raises ENet's peer limit from 4095 to 65535.
+// This changes the wire header, so clients must be built with it too
+#if defined(SCARABNET_LARGE_SERVER) && !defined(ENET_USE_MORE_PEERS)
+#define ENET_USE_MORE_PEERS
+#endif
+
+// Payload bytes a Packet stores inline, larger payloads go to the heap
+#ifndef SCARABNET_PACKET_INLINE_SIZE
+#define SCARABNET_PACKET_INLINE_SIZE 64
+#endif
+
 #define ENET_IMPLEMENTATION
 #include "enet/enet.h"
 
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 typedef uint8_t uint8;
 typedef uint16_t uint16;
 typedef uint32_t uint32;
@@ -40,14 +72,165 @@ enum class EventType : uint8 {
 };
 
 
+// Byte buffer that stores up to InlineCapacity bytes inside itself and only allocates for larger contents.
+// Has the parts of std::vector<uint8> packets use. Keeps its heap buffer when cleared or shrunk
+template <size_t InlineCapacity>
+class PacketPayload {
+	public:
+		PacketPayload() noexcept = default;
+
+		PacketPayload(const PacketPayload& other) {
+			this->assign(other.begin(), other.end());
+		}
+
+		PacketPayload(PacketPayload&& other) noexcept {
+			this->take(other);
+		}
+
+		inline PacketPayload& operator=(const PacketPayload& other) {
+			if(this != &other) {
+				this->assign(other.begin(), other.end());
+			}
+			return *this;
+		}
+
+		inline PacketPayload& operator=(PacketPayload&& other) noexcept {
+			if(this != &other) {
+				this->take(other);
+			}
+			return *this;
+		}
+
+		inline uint8* data() noexcept {
+			return this->heap ? this->heap.get() : this->buffer;
+		}
+		inline const uint8* data() const noexcept {
+			return this->heap ? this->heap.get() : this->buffer;
+		}
+
+		inline size_t size() const noexcept {
+			return this->length;
+		}
+
+		inline bool empty() const noexcept {
+			return this->length == 0;
+		}
+
+		// Bytes it can hold without allocating
+		inline size_t capacity() const noexcept {
+			return this->heap ? this->heap_capacity : InlineCapacity;
+		}
+
+		// Returns true if the contents are stored inline
+		inline bool is_inline() const noexcept {
+			return !this->heap;
+		}
+
+		inline uint8* begin() noexcept { return this->data(); }
+		inline uint8* end() noexcept { return this->data() + this->length; }
+		inline const uint8* begin() const noexcept { return this->data(); }
+		inline const uint8* end() const noexcept { return this->data() + this->length; }
+
+		inline uint8& operator[](const size_t index) noexcept {
+			return this->data()[index];
+		}
+		inline const uint8& operator[](const size_t index) const noexcept {
+			return this->data()[index];
+		}
+
+		inline void clear() noexcept {
+			this->length = 0;
+		}
+
+		// Replaces the contents with the bytes from first to last
+		inline void assign(const uint8* first, const uint8* last) {
+			const size_t count = last - first;
+			// Nothing to keep, don't copy the old contents if it has to grow
+			this->length = 0;
+			this->reserve(count);
+			if(count > 0) {
+				std::memcpy(this->data(), first, count);
+			}
+			this->length = count;
+		}
+
+		// New bytes are zeroed
+		inline void resize(const size_t count) {
+			this->reserve(count);
+			if(count > this->length) {
+				std::memset(this->data() + this->length, 0, count - this->length);
+			}
+			this->length = count;
+		}
+
+		inline void reserve(const size_t count) {
+			if(count <= this->capacity()) {
+				return;
+			}
+
+			const size_t grown = std::max(count, this->capacity() * 2);
+			std::unique_ptr<uint8[]> storage = std::make_unique_for_overwrite<uint8[]>(grown);
+			if(this->length > 0) {
+				std::memcpy(storage.get(), this->data(), this->length);
+			}
+			this->heap = std::move(storage);
+			this->heap_capacity = grown;
+		}
+
+		inline void push_back(const uint8 value) {
+			if(this->length == this->capacity()) {
+				this->reserve(this->length + 1);
+			}
+			this->data()[this->length++] = value;
+		}
+
+		// Copies size bytes to the end, growing geometrically
+		inline void append(const void* bytes, const size_t size) {
+			if(size == 0) {
+				return;
+			}
+			this->reserve(this->length + size);
+			std::memcpy(this->data() + this->length, bytes, size);
+			this->length += size;
+		}
+
+	private:
+		// Steals the heap buffer of other, or copies its inline bytes
+		inline void take(PacketPayload& other) noexcept {
+			if(other.heap) {
+				this->heap = std::move(other.heap);
+				this->heap_capacity = other.heap_capacity;
+			} else {
+				this->heap = nullptr;
+				if(other.length > 0) {
+					std::memcpy(this->buffer, other.buffer, other.length);
+				}
+			}
+			this->length = other.length;
+			other.length = 0;
+			other.heap_capacity = 0;
+		}
+
+		std::unique_ptr<uint8[]> heap = nullptr;
+		size_t heap_capacity = 0;
+		size_t length = 0;
+		// Left uninitialized, only the first length bytes are ever read
+		uint8 buffer[InlineCapacity > 0 ? InlineCapacity : 1];
+};
+
+
 struct Packet {
 	struct Header {
 		uint32 id   = 0;
 		uint32 type = 0;
 	};
 
+	// Header type reserved for packets aggregated by HostConfig::aggregate_size, don't send packets with it when aggregating
+	static constexpr uint32 BUNDLE_TYPE = UINT32_MAX;
+
 	Packet::Header header;
-	std::vector<uint8> data;
+	// Payloads up to SCARABNET_PACKET_INLINE_SIZE bytes are stored in the packet itself
+	PacketPayload<SCARABNET_PACKET_INLINE_SIZE> data;
 
 	// The whole size of the packet
 	inline size_t size() const noexcept {
@@ -97,14 +280,379 @@ struct Packet {
 };
 
 
+// Counters of the PacketPool
+struct PacketPoolStats {
+	// Packets handed out from the pool, and ones that had to be allocated
+	uint64_t hits   = 0;
+	uint64_t misses = 0;
+	// Packets deleted instead of pooled, because the pool was full or their buffer too large
+	uint64_t dropped = 0;
+	// Packets waiting in the shared list, not counting the ones cached by threads
+	uint64_t pooled = 0;
+};
+
+
+// Recycles the Packets of Receive events, with the capacity of their data vector.
+// Hosts take packets on the thread servicing them, and the application usually drops them on another one.
+// Each thread returns packets to its own cache, and caches trade packets with a shared list in batches,
+// so the lock is taken once per batch and a steady stream of received packets allocates nothing
+class PacketPool {
+	public:
+		// Returns a packet to the pool when a PacketPtr is dropped
+		struct Deleter {
+			inline void operator()(Packet* packet) const noexcept {
+				PacketPool::instance().release(packet);
+			}
+		};
+
+		// The process wide pool. Never destroyed, packets may be dropped until the very end
+		static inline PacketPool& instance() noexcept {
+			static PacketPool* const pool = new PacketPool();
+			return *pool;
+		}
+
+		PacketPool(const PacketPool&) = delete;
+
+		// Returns an empty packet, whose data may have capacity from previous use
+		inline std::unique_ptr<Packet, Deleter> acquire() {
+			ThreadCache* cache = PacketPool::thread_cache();
+			Packet* packet = nullptr;
+			if(cache) {
+				if(cache->count == 0) {
+					cache->count = this->take(cache->packets.data(), BATCH);
+				}
+				if(cache->count > 0) {
+					packet = cache->packets[--cache->count];
+				}
+			} else {
+				// Thread is exiting, its cache is gone
+				this->take(&packet, 1);
+			}
+
+			if(packet) {
+				this->hits.fetch_add(1, std::memory_order_relaxed);
+			} else {
+				this->misses.fetch_add(1, std::memory_order_relaxed);
+				packet = new Packet();
+			}
+			return std::unique_ptr<Packet, Deleter>(packet);
+		}
+
+		// Takes a packet back. Called by Deleter, on any thread
+		inline void release(Packet* packet) noexcept {
+			if(packet == nullptr) {
+				return;
+			}
+			// Don't keep a big buffer alive for the small packets that usually follow
+			if(packet->data.capacity() > MAX_CAPACITY) {
+				this->dropped.fetch_add(1, std::memory_order_relaxed);
+				delete packet;
+				return;
+			}
+
+			packet->header = {};
+			packet->data.clear();
+
+			ThreadCache* cache = PacketPool::thread_cache();
+			if(cache == nullptr) {
+				this->give(&packet, 1);
+				return;
+			}
+
+			cache->packets[cache->count++] = packet;
+			// This thread only drops packets, hand a batch to the threads that take them
+			if(cache->count == cache->packets.size()) {
+				cache->count -= BATCH;
+				this->give(cache->packets.data() + cache->count, BATCH);
+			}
+		}
+
+		// Safe to call from any thread
+		inline PacketPoolStats stats() noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			return PacketPoolStats {
+				.hits    = this->hits.load(std::memory_order_relaxed),
+				.misses  = this->misses.load(std::memory_order_relaxed),
+				.dropped = this->dropped.load(std::memory_order_relaxed),
+				.pooled  = this->shared.size()
+			};
+		}
+
+	private:
+		// Packets moved between a thread cache and the shared list at once
+		static constexpr size_t BATCH = 32;
+		// Most packets kept in the shared list, the rest are deleted
+		static constexpr size_t MAX_POOLED = 1024;
+		// Packets whose data grew past this are deleted instead of pooled
+		static constexpr size_t MAX_CAPACITY = 16 * 1024;
+
+		struct ThreadCache {
+			std::array<Packet*, 2 * BATCH> packets = {};
+			size_t count = 0;
+
+			~ThreadCache() {
+				// Packets dropped by thread_local destructors running after this one go to the shared list
+				PacketPool::thread_exited = true;
+				PacketPool::instance().give(this->packets.data(), this->count);
+				this->count = 0;
+			}
+		};
+
+		PacketPool() {
+			this->shared.reserve(MAX_POOLED);
+		}
+
+		// Returns nullptr once the calling thread destroyed its cache
+		static inline ThreadCache* thread_cache() noexcept {
+			if(PacketPool::thread_exited) {
+				return nullptr;
+			}
+			thread_local ThreadCache cache;
+			return &cache;
+		}
+
+		// Trivially destructible, so it can still be read after the cache is gone
+		static inline thread_local bool thread_exited = false;
+
+		// Moves up to count packets from the shared list into packets, returns how many were moved
+		inline size_t take(Packet** packets, const size_t count) noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			const size_t taken = std::min(count, this->shared.size());
+			std::copy(this->shared.end() - taken, this->shared.end(), packets);
+			this->shared.resize(this->shared.size() - taken);
+			return taken;
+		}
+
+		// Puts count packets on the shared list, deleting the ones that don't fit
+		inline void give(Packet** packets, const size_t count) noexcept {
+			size_t kept = 0;
+			{
+				std::scoped_lock lock = std::scoped_lock(this->mux);
+				kept = std::min(count, MAX_POOLED - this->shared.size());
+				this->shared.insert(this->shared.end(), packets, packets + kept);
+			}
+
+			for(size_t i = kept; i < count; i++) {
+				delete packets[i];
+			}
+			this->dropped.fetch_add(count - kept, std::memory_order_relaxed);
+		}
+
+		std::mutex mux;
+		// Reserved up front, never reallocates
+		std::vector<Packet*> shared;
+
+		std::atomic<uint64_t> hits    = 0;
+		std::atomic<uint64_t> misses  = 0;
+		std::atomic<uint64_t> dropped = 0;
+};
+
+
+// A received packet owned by a PacketPool, returned to it when dropped
+using PacketPtr = std::unique_ptr<Packet, PacketPool::Deleter>;
+
+
+// A received packet that keeps the ENet buffer it arrived in alive.
+// The payload is a view over that buffer, no copy is made.
+// The ENet packet is destroyed when the PacketRef is dropped
+class PacketRef {
+	public:
+		PacketRef() = default;
+
+		// Takes ownership of epacket, which must contain at least a Packet::Header
+		explicit PacketRef(ENetPacket* epacket) noexcept : epacket(epacket) {
+			std::memcpy(&this->header, epacket->data, sizeof(Packet::Header));
+		}
+
+		// Header of the packet
+		Packet::Header header;
+
+		// Returns true if it holds a packet
+		inline explicit operator bool() const noexcept {
+			return this->epacket != nullptr;
+		}
+
+		// The data after the header
+		inline std::span<const uint8> payload() const noexcept {
+			if(!this->epacket) {
+				return {};
+			}
+			return { this->epacket->data + sizeof(Packet::Header), this->epacket->dataLength - sizeof(Packet::Header) };
+		}
+
+		// The whole size of the packet
+		inline size_t size() const noexcept {
+			return this->epacket ? this->epacket->dataLength : 0;
+		}
+
+		// Unpack payload into a std::string
+		inline std::string unpack_string() const noexcept {
+			const std::span<const uint8> payload = this->payload();
+			return std::string(payload.begin(), payload.end());
+		}
+
+		// Unpack payload into a type.
+		// T must be a trivially copyable type (simple structs, int, float etc)
+		template <typename T>
+		inline std::optional<T> unpack_data() const {
+			static_assert(std::is_trivially_copyable_v<T>,
+				"get_data can only be used with trivially copyable types (simple structs, int, float, etc.)");
+
+			const std::span<const uint8> payload = this->payload();
+			if(payload.size() != sizeof(T)) {
+				return std::nullopt;
+			}
+
+			T result_object;
+			std::memcpy(&result_object, payload.data(), sizeof(T));
+			return result_object;
+		}
+
+	private:
+		struct Deleter {
+			inline void operator()(ENetPacket* epacket) const noexcept {
+				enet_packet_destroy(epacket);
+			}
+		};
+
+		std::unique_ptr<ENetPacket, Deleter> epacket = nullptr;
+};
+
+
 // Events sent/received by server and client
 struct Event {
 	// Peer owner of the event
 	uint32 peer_id = 0;
 	// Type of the event
 	EventType type = EventType::None;
+	// Channel a Receive event arrived on
+	uint8 channel = 0;
+
+	// Received packet, copied out of the ENet buffer into a pooled Packet
+	PacketPtr packet = nullptr;
+	// Received packet when zero copy is enabled, references the ENet buffer
+	PacketRef ref = {};
+
+	// Header of a Receive event, regardless of how it was received
+	inline const Packet::Header* header() const noexcept {
+		if(this->packet) {
+			return &this->packet->header;
+		}
+		return this->ref ? &this->ref.header : nullptr;
+	}
+
+	// Payload of a Receive event, regardless of how it was received
+	inline std::span<const uint8> payload() const noexcept {
+		if(this->packet) {
+			return this->packet->data;
+		}
+		return this->ref.payload();
+	}
+};
+
+
+// Receives events in place on the thread servicing the host (the network thread, or the service() caller),
+// without allocating an Event or going through the event queue.
+// Each callback returns true if it consumed the event, false to still deliver it as an Event.
+// Callbacks run on the network thread, they should be quick and must not block
+class EventHandler {
+	public:
+		virtual ~EventHandler() = default;
+
+		virtual bool on_connect([[maybe_unused]] const uint32 peer_id) {
+			return false;
+		}
+
+		// payload is only valid for the duration of the call
+		virtual bool on_receive([[maybe_unused]] const uint32 peer_id, [[maybe_unused]] const Packet::Header& header,
+			[[maybe_unused]] std::span<const uint8> payload) {
+			return false;
+		}
+
+		virtual bool on_disconnect([[maybe_unused]] const uint32 peer_id) {
+			return false;
+		}
+};
+
+
+// Compresses whole datagrams before ENet sends them, see HostConfig::compressor.
+// Both ends of a connection must use the same compression
+class Compressor {
+	public:
+		virtual ~Compressor() = default;
+
+		// Compresses input into output.
+		// Returns the compressed size, or 0 if it doesn't fit in output (the datagram is then sent uncompressed)
+		virtual size_t compress(std::span<const uint8> input, std::span<uint8> output) = 0;
+
+		// Decompresses input into output.
+		// Returns the decompressed size, or 0 if input is malformed or doesn't fit in output (the datagram is dropped)
+		virtual size_t decompress(std::span<const uint8> input, std::span<uint8> output) = 0;
+};
 
-	std::unique_ptr<Packet> packet = nullptr;
+
+// Counters of a host's compression, see Server::compression_stats
+struct CompressionStats {
+	// Datagrams offered to the compressor, and how many of them came out smaller and were sent compressed
+	uint64_t datagrams  = 0;
+	uint64_t compressed = 0;
+	// Bytes of those datagrams before and after compression
+	uint64_t bytes_in  = 0;
+	uint64_t bytes_out = 0;
+	// Compressed datagrams received, and how many of them failed to decompress
+	uint64_t received = 0;
+	uint64_t failures = 0;
+
+	// Sent size over original size, 1 when nothing was sent
+	inline double ratio() const noexcept {
+		return this->bytes_in == 0 ? 1.0 : (double)this->bytes_out / (double)this->bytes_in;
+	}
+};
+
+
+// Options shared by Server and Client
+class EventSignal;
+
+struct HostConfig {
+	// Logs internal events and traffic
+	bool show_log = false;
+	// Received packets are not copied into Event::packet.
+	// Instead Event::ref keeps the ENet buffer alive until the event is dropped
+	bool zero_copy = false;
+	// ENet channels, numbered from 0. Each one is ordered and resent on its own,
+	// so a lost reliable packet only stalls its channel. 0 allows ENet's maximum of 255
+	uint8 channels = 2;
+	// Longest time in milliseconds the network thread sleeps when idle.
+	// Sends wake it immediately, this bounds how late ENet timers (resends, pings) run
+	uint32 service_timeout = 5;
+	// Services the host on a dedicated network thread.
+	// When false the application does it by calling service() in its own loop,
+	// and events are handed to it directly instead of going through the event queue
+	bool network_thread = true;
+	// Server only. Binds with SO_REUSEPORT so several servers can listen on the same port,
+	// the kernel spreads clients across them. Used by ShardedServer, fails where unsupported
+	bool reuse_port = false;
+	// Server only. Client ids start at this slot index, so servers sharing an id space hand out distinct ids.
+	// Used by ShardedServer, id_base + max_clients must fit in 16 bits
+	uint16 id_base = 0;
+	// Server only. Also notified whenever an event is queued or the server stops, so one thread can wait on
+	// several servers. Not owned, must outlive the server. Used by ShardedServer
+	EventSignal* event_signal = nullptr;
+	// Datagrams received or sent per recvmmsg/sendmmsg syscall, 0 uses one syscall per datagram.
+	// Linux only, ignored elsewhere
+	uint32 socket_batch = 0;
+	// Receive buffers and send slots of an io_uring socket backend, 0 keeps the socket syscalls.
+	// Linux 5.19 and later, takes precedence over socket_batch, falls back to it where unavailable
+	uint32 io_uring_entries = 0;
+	// Largest aggregated packet in bytes, 0 sends every Packet on its own. Capped to what fits in one datagram.
+	// The thread servicing the host bundles sends per peer and channel, and flush() sends each bundle as one ENet packet.
+	// The receiver splits them back into separate events, so both ends must enable it. Call flush() once per tick
+	uint32 aggregate_size = 0;
+	// Compresses datagrams with the built-in LZCompressor. Both ends must enable it
+	bool compress = false;
+	// Compresses datagrams with this instead of the built-in compressor. Not owned, must outlive the host.
+	// Called from the thread servicing the host, so it must be thread safe if several hosts share it
+	Compressor* compressor = nullptr;
 };
 
 
@@ -128,138 +676,2132 @@ enum PacketFlag : uint8 {
 };
 
 
-#define CURRENT_TIME_STREAM \
-	([]() -> std::string { \
-		auto now = std::chrono::system_clock::now(); \
-		std::time_t time = std::chrono::system_clock::to_time_t(now); \
-		std::tm tm = *std::localtime(&time); \
-		std::ostringstream oss; \
-		oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S"); \
-		return oss.str(); \
-	})()
-
-#define LOG_SERVER(message) \
-	if(this->show_log) \
-		std::cout << "[" << CURRENT_TIME_STREAM << "] " << message << std::endl;
+// Builds a packet directly inside an ENet buffer.
+// The header is written up front and the payload is filled in place,
+// so sending it needs no further copies
+class PacketBuilder {
+	public:
+		PacketBuilder(const Packet::Header& header, const size_t payload_size, const PacketFlag flag = PacketFlag::RELIABLE) noexcept
+			: epacket(enet_packet_create(NULL, sizeof(Packet::Header) + payload_size, (ENetPacketFlag)flag)) {
+			if(this->epacket) {
+				std::memcpy(this->epacket->data, &header, sizeof(Packet::Header));
+			}
+		}
 
+		PacketBuilder(const PacketBuilder&) = delete;
+		PacketBuilder(PacketBuilder&& other) noexcept : epacket(std::exchange(other.epacket, nullptr)) {}
+		~PacketBuilder() noexcept {
+			// Never sent
+			if(this->epacket) {
+				enet_packet_destroy(this->epacket);
+			}
+		}
 
+		// Returns true if the ENet packet was allocated
+		inline explicit operator bool() const noexcept {
+			return this->epacket != nullptr;
+		}
 
-namespace PacketHelper {
-	inline std::vector<uint8> serialize_packet(const Packet& packet) noexcept{
-		std::vector<uint8> buffer;
-		buffer.resize(packet.size());
+		// Writable data after the header
+		inline std::span<uint8> payload() noexcept {
+			if(!this->epacket) {
+				return {};
+			}
+			return { this->epacket->data + sizeof(Packet::Header), this->epacket->dataLength - sizeof(Packet::Header) };
+		}
 
-		// Copy the header into the beginning of the buffer
-		std::memcpy(buffer.data(), &packet.header, sizeof(Packet::Header));
-		// Copy the packet data into the buffer, after the header
-		std::memcpy(buffer.data() + sizeof(Packet::Header), packet.data.data(), packet.data.size());
+		// Copies data to the start of the payload, growing it if needed
+		inline void putdata(const void* data, const size_t size) noexcept {
+			if(this->payload().size() < size) {
+				this->resize(size);
+			}
+			if(this->epacket) {
+				std::memcpy(this->epacket->data + sizeof(Packet::Header), data, size);
+			}
+		}
 
-		return buffer;
-	}
+		// Changes the payload size. Shrinking is free, growing reallocates the ENet buffer
+		inline void resize(const size_t payload_size) noexcept {
+			if(!this->epacket) {
+				return;
+			}
+			ENetPacket* resized = enet_packet_resize(this->epacket, sizeof(Packet::Header) + payload_size);
+			if(resized == NULL) {
+				// Old packet is still valid on failure
+				enet_packet_destroy(this->epacket);
+			}
+			this->epacket = resized;
+		}
 
-	inline std::unique_ptr<Packet> deserialize_packet(const uint8* data, const size_t size) noexcept {
-		// Should containg at least a Packet::Header
-		if(size < sizeof(Packet::Header)) {
-			return nullptr;
+		// The whole size of the packet
+		inline size_t size() const noexcept {
+			return this->epacket ? this->epacket->dataLength : 0;
 		}
 
-		std::unique_ptr<Packet> packet = std::make_unique<Packet>();
+		// Gives up ownership of the ENet packet, used when sending
+		inline ENetPacket* release() noexcept {
+			return std::exchange(this->epacket, nullptr);
+		}
 
-		// Unpack header from the beginning
-		std::memcpy(&packet->header, data, sizeof(Packet::Header));
+		// Returns a builder holding its own copy of the packet, for hosts that can't share it.
+		// ENet's reference count is not thread safe
+		inline PacketBuilder copy() const noexcept {
+			if(!this->epacket) {
+				return PacketBuilder(nullptr);
+			}
+			return PacketBuilder(enet_packet_create(this->epacket->data, this->epacket->dataLength, this->epacket->flags));
+		}
 
-		// Unpack the rest of the payload, which could be 0 bytes
-		const uint8* payload_start = data + sizeof(Packet::Header);
-		const size_t paylaod_size  = size - sizeof(Packet::Header);
-		packet->putdata(payload_start, paylaod_size);
+	private:
+		explicit PacketBuilder(ENetPacket* epacket) noexcept : epacket(epacket) {}
 
-		return packet;
-	}
+		ENetPacket* epacket = nullptr;
 };
 
 
-template <typename T>
-class TSQueue {
+// Appends fields to the payload of a packet, after whatever it already holds.
+// Values are written in host byte order like the header, varints as LEB128.
+// The payload grows geometrically, so a message of many small fields reallocates a few times at most
+class PacketWriter {
 	public:
-		TSQueue() = default;
-		TSQueue(const TSQueue<T>&) = delete;
-		virtual ~TSQueue() {
-			this->clear();
+		explicit PacketWriter(Packet& packet) noexcept : packet(packet) {}
+
+		// Appends a trivially copyable value (integers, floats, enums, simple structs)
+		template <typename T>
+		inline PacketWriter& write(const T& value) {
+			static_assert(std::is_trivially_copyable_v<T>,
+				"write can only be used with trivially copyable types (simple structs, int, float, etc.)");
+			this->packet.data.append(&value, sizeof(T));
+			return *this;
 		}
 
-		// Returns item at front of queue
-		inline const T& front() const noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			return this->queue.front();
+		// Appends an unsigned integer in 1 to 10 bytes, 7 bits per byte
+		inline PacketWriter& write_varint(uint64_t value) {
+			uint8 bytes[10];
+			size_t count = 0;
+			while(value >= 0x80) {
+				bytes[count++] = (uint8)(value | 0x80);
+				value >>= 7;
+			}
+			bytes[count++] = (uint8)value;
+			this->packet.data.append(bytes, count);
+			return *this;
 		}
 
-		// Returns item at back of queue
-		inline const T& back() const noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			return this->queue.back();
+		// Appends a signed integer as a zigzag varint, so small negative values stay small
+		inline PacketWriter& write_varint_signed(const int64_t value) {
+			return this->write_varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
 		}
 
-		// Adds an item to back of queue
-		inline void push_back(const T& item) noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			this->queue.push_back(std::move(item));
+		// Appends a string prefixed by its length as a varint
+		inline PacketWriter& write_string(const std::string_view string) {
+			this->write_varint(string.size());
+			this->packet.data.append(string.data(), string.size());
+			return *this;
 		}
 
-		// Adds an item to back of queue
-		inline void push_back(T&& item) noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			this->queue.push_back(std::move(item));
+		// Appends bytes prefixed by their length as a varint
+		inline PacketWriter& write_bytes(const std::span<const uint8> bytes) {
+			this->write_varint(bytes.size());
+			this->packet.data.append(bytes.data(), bytes.size());
+			return *this;
 		}
 
-		// Adds an item to back of queue
-		inline void push_front(const T& item) noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			this->queue.push_front(std::move(item));
+		// Appends bytes as they are, the reader must know their size
+		inline PacketWriter& write_raw(const void* bytes, const size_t size) {
+			this->packet.data.append(bytes, size);
+			return *this;
 		}
 
-		// Adds an item to back of queue
-		inline void push_front(T&& item) noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			this->queue.push_front(std::move(item));
+		// Reserves room for size more bytes
+		inline void reserve(const size_t size) {
+			this->packet.data.reserve(this->packet.data.size() + size);
 		}
 
-		// Returns true if queue has no items
-		inline bool empty() const noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			return this->queue.empty();
+		// Payload size written so far
+		inline size_t size() const noexcept {
+			return this->packet.data.size();
 		}
 
-		// Returns number of items in queue
-		inline size_t count() const noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			return this->queue.count();
+	private:
+		Packet& packet;
+};
+
+
+// Reads fields written by PacketWriter from a payload, front to back, without copying it.
+// A read that runs past the end returns std::nullopt, doesn't move the cursor and fails every read after it,
+// so a message can be read field by field and checked once at the end.
+// Views returned by read_string, read_bytes and read_raw point into the payload, which must outlive them
+class PacketReader {
+	public:
+		explicit PacketReader(const std::span<const uint8> payload) noexcept : payload(payload) {}
+
+		// Returns false if a read failed
+		inline explicit operator bool() const noexcept {
+			return !this->failed;
 		}
 
-		// Clear queue
-		inline void clear() noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			return this->queue.clear();
+		// Reads a trivially copyable value (integers, floats, enums, simple structs)
+		template <typename T>
+		inline std::optional<T> read() noexcept {
+			static_assert(std::is_trivially_copyable_v<T>,
+				"read can only be used with trivially copyable types (simple structs, int, float, etc.)");
+
+			const std::optional<std::span<const uint8>> bytes = this->read_raw(sizeof(T));
+			if(!bytes) {
+				return std::nullopt;
+			}
+
+			T result_object;
+			std::memcpy(&result_object, bytes->data(), sizeof(T));
+			return result_object;
 		}
 
-		// Removes and returns item from front of queue
-		inline T pop_front() noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			T t = std::move(this->queue.front());
-			this->queue.pop_front();
-			return t;
+		inline std::optional<uint64_t> read_varint() noexcept {
+			if(this->failed) {
+				return std::nullopt;
+			}
+
+			uint64_t value = 0;
+			for(size_t offset = this->offset, shift = 0; offset < this->payload.size() && shift < 64; offset++, shift += 7) {
+				const uint8 byte = this->payload[offset];
+				// The 10th byte only holds bit 63, anything more overflows 64 bits
+				if(shift == 63 && byte > 1) {
+					break;
+				}
+				value |= (uint64_t)(byte & 0x7F) << shift;
+				if((byte & 0x80) == 0) {
+					this->offset = offset + 1;
+					return value;
+				}
+			}
+
+			// Ran out of bytes, longer than 10 bytes or overflowing
+			this->failed = true;
+			return std::nullopt;
 		}
 
-		// Removes and returns item from back of queue
-		inline T pop_back() noexcept {
-			std::scoped_lock lock = std::scoped_lock(this->mux);
-			T t = std::move(this->queue.back());
-			this->queue.pop_front();
-			return t;
+		inline std::optional<int64_t> read_varint_signed() noexcept {
+			const std::optional<uint64_t> value = this->read_varint();
+			if(!value) {
+				return std::nullopt;
+			}
+			return (int64_t)(*value >> 1) ^ -(int64_t)(*value & 1);
 		}
 
-	private:
-		mutable std::mutex mux;
-		std::deque<T> queue;
+		// Reads a string written by write_string
+		inline std::optional<std::string_view> read_string() noexcept {
+			const std::optional<std::span<const uint8>> bytes = this->read_bytes();
+			if(!bytes) {
+				return std::nullopt;
+			}
+			return std::string_view(reinterpret_cast<const char*>(bytes->data()), bytes->size());
+		}
+
+		// Reads bytes written by write_bytes
+		inline std::optional<std::span<const uint8>> read_bytes() noexcept {
+			const size_t start = this->offset;
+			const std::optional<uint64_t> size = this->read_varint();
+			if(!size) {
+				return std::nullopt;
+			}
+
+			const std::optional<std::span<const uint8>> bytes = this->read_raw(*size);
+			if(!bytes) {
+				// Leave the cursor before the length prefix
+				this->offset = start;
+			}
+			return bytes;
+		}
+
+		// Reads the next size bytes
+		inline std::optional<std::span<const uint8>> read_raw(const uint64_t size) noexcept {
+			if(this->failed || size > this->remaining()) {
+				this->failed = true;
+				return std::nullopt;
+			}
+
+			const std::span<const uint8> bytes = this->payload.subspan(this->offset, size);
+			this->offset += size;
+			return bytes;
+		}
+
+		// Bytes not read yet
+		inline size_t remaining() const noexcept {
+			return this->payload.size() - this->offset;
+		}
+
+		// Bytes read so far
+		inline size_t position() const noexcept {
+			return this->offset;
+		}
+
+	private:
+		std::span<const uint8> payload;
+		size_t offset = 0;
+		bool failed = false;
+};
+
+
+// Bits needed to store every value from 0 to range
+constexpr uint32 bits_required(const uint32 range) noexcept {
+	return (uint32)std::bit_width(range);
+}
+
+
+// Appends values packed to the bit to the payload of a packet, after whatever it already holds.
+// Bounded integers take only the bits their range needs, floats are quantized to a range and precision,
+// and rotations use the smallest three encoding. Bits fill each byte from the lowest one.
+// Read them back with a BitReader, with the same ranges, in the same order.
+// Don't append to the packet any other way until done writing bits
+class BitWriter {
+	public:
+		explicit BitWriter(Packet& packet) noexcept : packet(packet) {}
+
+		// Appends the low bits of value, up to 32
+		inline BitWriter& write_bits(uint32 value, uint32 bits) {
+			while(bits > 0) {
+				if(this->used == 0) {
+					this->packet.data.push_back(0);
+				}
+
+				const uint32 taken = std::min(bits, 8 - this->used);
+				const uint32 mask  = (1u << taken) - 1;
+				this->packet.data[this->packet.data.size() - 1] |= (uint8)((value & mask) << this->used);
+
+				value >>= taken;
+				bits -= taken;
+				this->used = (this->used + taken) & 7;
+				this->count += taken;
+			}
+			return *this;
+		}
+
+		inline BitWriter& write_bool(const bool value) {
+			return this->write_bits(value ? 1 : 0, 1);
+		}
+
+		// Appends value, clamped to [min, max], in as many bits as the range needs.
+		// A max below min is taken as min, which writes nothing
+		inline BitWriter& write_int(const int32_t value, const int32_t min, const int32_t max) {
+			const int32_t upper = std::max(min, max);
+			const int32_t clamped = std::clamp(value, min, upper);
+			return this->write_bits((uint32)((int64_t)clamped - min), bits_required((uint32)((int64_t)upper - min)));
+		}
+
+		// Appends value, clamped to [min, max], rounded to a multiple of precision or finer
+		inline BitWriter& write_float(const float value, const float min, const float max, const float precision) {
+			return this->write_quantized(value, min, max, BitWriter::float_bits(min, max, precision));
+		}
+
+		// Appends value, clamped to [min, max], in bits bits
+		inline BitWriter& write_quantized(const float value, const float min, const float max, const uint32 bits) {
+			// In double, a float rounds 2^32 - 1 up to 2^32, which wraps to 0
+			const double steps = (double)(((uint64_t)1 << bits) - 1);
+			const double normalized = max > min ? ((double)std::clamp(value, min, max) - min) / ((double)max - min) : 0.0;
+			// NaN, from a NaN value or an infinite range, writes min
+			return this->write_bits(normalized >= 0.0 ? (uint32)std::llround(std::min(normalized, 1.0) * steps) : 0, bits);
+		}
+
+		// Appends a unit quaternion as its largest component's index in 2 bits,
+		// and the other three components in bits bits each
+		inline BitWriter& write_quaternion(const float x, const float y, const float z, const float w, const uint32 bits = 10) {
+			const float components[4] = { x, y, z, w };
+			uint32 largest = 0;
+			for(uint32 i = 1; i < 4; i++) {
+				if(std::fabs(components[i]) > std::fabs(components[largest])) {
+					largest = i;
+				}
+			}
+
+			// q and -q are the same rotation, keep the largest positive so it can be rebuilt from the others
+			const float sign = components[largest] < 0 ? -1.0f : 1.0f;
+			this->write_bits(largest, 2);
+			for(uint32 i = 0; i < 4; i++) {
+				if(i != largest) {
+					this->write_quantized(components[i] * sign, -QUATERNION_BOUND, QUATERNION_BOUND, bits);
+				}
+			}
+			return *this;
+		}
+
+		// Bits written so far
+		inline size_t bits() const noexcept {
+			return this->count;
+		}
+
+		// Bits a float written with this range and precision takes.
+		// An empty or inverted range takes none, and so does NaN. A precision that isn't positive,
+		// or a range too fine for 32 bits, takes all 32
+		static inline uint32 float_bits(const float min, const float max, const float precision) noexcept {
+			if(!(max > min)) {
+				return 0;
+			}
+			if(!(precision > 0.0f)) {
+				return 32;
+			}
+			const double steps = std::ceil(((double)max - min) / precision);
+			return !(steps < 4294967295.0) ? 32 : bits_required((uint32)steps);
+		}
+
+		// The three smaller components of a unit quaternion are within this bound
+		static constexpr float QUATERNION_BOUND = 0.70710678f;
+
+	private:
+		Packet& packet;
+		// Bits used in the last byte of the payload, 0 when it's full
+		uint32 used = 0;
+		size_t count = 0;
+};
+
+
+// Reads values written by BitWriter from a payload, with the same ranges, in the same order.
+// A read that runs past the end returns std::nullopt and fails every read after it
+class BitReader {
+	public:
+		explicit BitReader(const std::span<const uint8> payload) noexcept : payload(payload) {}
+
+		// Returns false if a read failed
+		inline explicit operator bool() const noexcept {
+			return !this->failed;
+		}
+
+		// Reads bits bits, up to 32. More fails the reader like reading past the end
+		inline std::optional<uint32> read_bits(uint32 bits) noexcept {
+			if(this->failed || bits > 32 || bits > this->remaining()) {
+				this->failed = true;
+				return std::nullopt;
+			}
+
+			uint32 value = 0;
+			uint32 shift = 0;
+			while(bits > 0) {
+				const uint32 used  = this->offset & 7;
+				const uint32 taken = std::min(bits, 8 - used);
+				const uint32 mask  = (1u << taken) - 1;
+				value |= ((uint32)(this->payload[this->offset >> 3] >> used) & mask) << shift;
+
+				shift += taken;
+				bits -= taken;
+				this->offset += taken;
+			}
+			return value;
+		}
+
+		inline std::optional<bool> read_bool() noexcept {
+			const std::optional<uint32> value = this->read_bits(1);
+			if(!value) {
+				return std::nullopt;
+			}
+			return *value != 0;
+		}
+
+		inline std::optional<int32_t> read_int(const int32_t min, const int32_t max) noexcept {
+			// Same range as write_int
+			const int32_t upper = std::max(min, max);
+			const std::optional<uint32> value = this->read_bits(bits_required((uint32)((int64_t)upper - min)));
+			if(!value) {
+				return std::nullopt;
+			}
+			// A corrupted value may be out of the range
+			return (int32_t)std::min<int64_t>((int64_t)min + *value, upper);
+		}
+
+		inline std::optional<float> read_float(const float min, const float max, const float precision) noexcept {
+			return this->read_quantized(min, max, BitWriter::float_bits(min, max, precision));
+		}
+
+		inline std::optional<float> read_quantized(const float min, const float max, const uint32 bits) noexcept {
+			const std::optional<uint32> value = this->read_bits(bits);
+			if(!value) {
+				return std::nullopt;
+			}
+			const double steps = (double)(((uint64_t)1 << bits) - 1);
+			return steps > 0 && max > min ? (float)(min + ((double)max - min) * (*value / steps)) : min;
+		}
+
+		// Reads a quaternion written by write_quaternion, as { x, y, z, w }
+		inline std::optional<std::array<float, 4>> read_quaternion(const uint32 bits = 10) noexcept {
+			const std::optional<uint32> largest = this->read_bits(2);
+			if(!largest) {
+				return std::nullopt;
+			}
+
+			std::array<float, 4> components = {};
+			float sum = 0;
+			for(uint32 i = 0; i < 4; i++) {
+				if(i == *largest) {
+					continue;
+				}
+				const std::optional<float> component = this->read_quantized(-BitWriter::QUATERNION_BOUND, BitWriter::QUATERNION_BOUND, bits);
+				if(!component) {
+					return std::nullopt;
+				}
+				components[i] = *component;
+				sum += *component * *component;
+			}
+			components[*largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+			return components;
+		}
+
+		// Bits not read yet
+		inline size_t remaining() const noexcept {
+			return this->payload.size() * 8 - this->offset;
+		}
+
+		// Bits read so far
+		inline size_t position() const noexcept {
+			return this->offset;
+		}
+
+	private:
+		std::span<const uint8> payload;
+		// In bits
+		size_t offset = 0;
+		bool failed = false;
+};
+
+
+// Binds a message struct to the header type it is sent with, see MessageRegistry
+template <typename T, uint32 Type>
+struct Message {
+	static_assert(std::is_trivially_copyable_v<T>,
+		"Messages must be trivially copyable types (simple structs, int, float, etc.)");
+
+	using type = T;
+	static constexpr uint32 id = Type;
+};
+
+
+// Assigns header types to message structs at compile time, and sends and receives them as their raw bytes.
+// Received packets are dispatched through a table of function pointers indexed by header type,
+// built at compile time for each handler type, so a lookup is one bounds check and one indirect call.
+// The table has an entry for every type up to the largest registered one, keep them small and dense
+//
+// using Messages = MessageRegistry<Message<Move, 1>, Message<Chat, 2>>;
+template <typename... Messages>
+class MessageRegistry {
+	static_assert(sizeof...(Messages) > 0, "MessageRegistry needs at least one message");
+
+	public:
+		// Largest registered header type
+		static constexpr uint32 MAX_TYPE = std::max({ Messages::id... });
+		static_assert(MAX_TYPE < 65536, "Message types index a table, keep them below 65536");
+		static_assert([]() {
+			constexpr std::array<uint32, sizeof...(Messages)> ids = { Messages::id... };
+			for(size_t i = 0; i < ids.size(); i++) {
+				for(size_t j = i + 1; j < ids.size(); j++) {
+					if(ids[i] == ids[j]) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}(), "Two messages are registered with the same type");
+		static_assert([]() {
+			constexpr auto count = []<typename T>(std::type_identity<T>) {
+				return ((std::is_same_v<T, typename Messages::type> ? 1 : 0) + ...);
+			};
+			return ((count(std::type_identity<typename Messages::type>()) == 1) && ...);
+		}(), "A message struct is registered twice");
+
+		// Returns true if T is a registered message
+		template <typename T>
+		static constexpr bool contains() noexcept {
+			return (std::is_same_v<T, typename Messages::type> || ...);
+		}
+
+		// Header type of message T
+		template <typename T>
+		static constexpr uint32 type_of() noexcept {
+			static_assert(contains<T>(), "Message type is not registered");
+			return ((std::is_same_v<T, typename Messages::type> ? Messages::id : 0) + ...);
+		}
+
+		// Creates a packet holding message
+		template <typename T>
+		static inline Packet make_packet(const T& message, const uint32 packet_id = 0) {
+			Packet packet;
+			packet.header = { .id = packet_id, .type = type_of<T>() };
+			packet.putdata(&message, sizeof(T));
+			return packet;
+		}
+
+		// Creates a packet holding message directly in an ENet buffer, see PacketBuilder
+		template <typename T>
+		static inline PacketBuilder make_builder(const T& message, const PacketFlag flag = PacketFlag::RELIABLE, const uint32 packet_id = 0) noexcept {
+			PacketBuilder builder = PacketBuilder({ .id = packet_id, .type = type_of<T>() }, sizeof(T), flag);
+			if(builder) {
+				std::memcpy(builder.payload().data(), &message, sizeof(T));
+			}
+			return builder;
+		}
+
+		// Returns the message T in a payload received with header, if it is one
+		template <typename T>
+		static inline std::optional<T> decode(const Packet::Header& header, const std::span<const uint8> payload) noexcept {
+			if(header.type != type_of<T>() || payload.size() != sizeof(T)) {
+				return std::nullopt;
+			}
+
+			T message;
+			std::memcpy(&message, payload.data(), sizeof(T));
+			return message;
+		}
+
+		// Decodes the message in payload and calls handler(peer_id, const T&) with it.
+		// Returns false if the type is not registered or the payload is not the size of its message
+		template <typename Handler>
+		static inline bool dispatch(Handler& handler, const uint32 peer_id, const Packet::Header& header, const std::span<const uint8> payload) {
+			if(header.type > MAX_TYPE) {
+				return false;
+			}
+			const Dispatch<Handler> entry = table<Handler>[header.type];
+			return entry && entry(handler, peer_id, payload);
+		}
+
+		// Same as above, for a Receive event
+		template <typename Handler>
+		static inline bool dispatch(Handler& handler, const Event& event) {
+			const Packet::Header* header = event.header();
+			return header && dispatch(handler, event.peer_id, *header, event.payload());
+		}
+
+	private:
+		template <typename Handler>
+		using Dispatch = bool (*)(Handler&, uint32, std::span<const uint8>);
+
+		template <typename Handler, typename M>
+		static inline bool invoke(Handler& handler, const uint32 peer_id, const std::span<const uint8> payload) {
+			using T = typename M::type;
+			static_assert(std::is_invocable_v<Handler&, uint32, const T&>,
+				"Handler must be callable as handler(uint32 peer_id, const T& message) for every message");
+
+			if(payload.size() != sizeof(T)) {
+				return false;
+			}
+			T message;
+			std::memcpy(&message, payload.data(), sizeof(T));
+			handler(peer_id, static_cast<const T&>(message));
+			return true;
+		}
+
+		template <typename Handler>
+		static constexpr std::array<Dispatch<Handler>, MAX_TYPE + 1> make_table() noexcept {
+			std::array<Dispatch<Handler>, MAX_TYPE + 1> table = {};
+			((table[Messages::id] = &invoke<Handler, Messages>), ...);
+			return table;
+		}
+
+		template <typename Handler>
+		static constexpr std::array<Dispatch<Handler>, MAX_TYPE + 1> table = make_table<Handler>();
+};
+
+
+#define CURRENT_TIME_STREAM \
+	([]() -> std::string { \
+		auto now = std::chrono::system_clock::now(); \
+		std::time_t time = std::chrono::system_clock::to_time_t(now); \
+		std::tm tm = *std::localtime(&time); \
+		std::ostringstream oss; \
+		oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S"); \
+		return oss.str(); \
+	})()
+
+#define LOG_SERVER(message) \
+	if(this->show_log) \
+		std::cout << "[" << CURRENT_TIME_STREAM << "] " << message << std::endl;
+
+
+
+namespace PacketHelper {
+	inline std::vector<uint8> serialize_packet(const Packet& packet) noexcept{
+		std::vector<uint8> buffer;
+		buffer.resize(packet.size());
+
+		// Copy the header into the beginning of the buffer
+		std::memcpy(buffer.data(), &packet.header, sizeof(Packet::Header));
+		// Copy the packet data into the buffer, after the header
+		std::memcpy(buffer.data() + sizeof(Packet::Header), packet.data.data(), packet.data.size());
+
+		return buffer;
+	}
+
+	// Creates an ENet packet with the header and data of packet.
+	// Written straight into the ENet buffer, without a temporary vector
+	inline ENetPacket* create_enet_packet(const Packet& packet, const PacketFlag flag) noexcept {
+		ENetPacket* epacket = enet_packet_create(NULL, packet.size(), (ENetPacketFlag)flag);
+		if(epacket == NULL) {
+			return nullptr;
+		}
+
+		std::memcpy(epacket->data, &packet.header, sizeof(Packet::Header));
+		if(!packet.data.empty()) {
+			std::memcpy(epacket->data + sizeof(Packet::Header), packet.data.data(), packet.data.size());
+		}
+		return epacket;
+	}
+
+	// The Packet comes from the PacketPool, so in steady state nothing is allocated
+	inline PacketPtr deserialize_packet(const uint8* data, const size_t size) noexcept {
+		// Should containg at least a Packet::Header
+		if(size < sizeof(Packet::Header)) {
+			return nullptr;
+		}
+
+		PacketPtr packet = PacketPool::instance().acquire();
+
+		// Unpack header from the beginning
+		std::memcpy(&packet->header, data, sizeof(Packet::Header));
+
+		// Unpack the rest of the payload, which could be 0 bytes
+		const uint8* payload_start = data + sizeof(Packet::Header);
+		const size_t paylaod_size  = size - sizeof(Packet::Header);
+		packet->putdata(payload_start, paylaod_size);
+
+		return packet;
+	}
+
+	// Offers a packet received by ENet to handler.
+	// Returns true if the handler consumed it, in which case epacket was destroyed
+	inline bool handle_packet(EventHandler* handler, const uint32 peer_id, ENetPacket* epacket) {
+		if(handler == nullptr || epacket->dataLength < sizeof(Packet::Header)) {
+			return false;
+		}
+
+		Packet::Header header;
+		std::memcpy(&header, epacket->data, sizeof(Packet::Header));
+		const std::span<const uint8> payload = { epacket->data + sizeof(Packet::Header), epacket->dataLength - sizeof(Packet::Header) };
+
+		if(!handler->on_receive(peer_id, header, payload)) {
+			return false;
+		}
+		enet_packet_destroy(epacket);
+		return true;
+	}
+
+	// Splits a packet aggregated by PacketAggregator, offering each message to handler
+	// and passing the ones it doesn't consume to emit(Event&&). Bundled messages are always copied.
+	// Returns false if epacket is not a bundle, otherwise epacket was destroyed
+	template <typename F>
+	inline bool receive_bundle(EventHandler* handler, const uint32 peer_id, const uint8 channel, ENetPacket* epacket, F&& emit) {
+		Packet::Header bundle;
+		if(epacket->dataLength < sizeof(Packet::Header)) {
+			return false;
+		}
+		std::memcpy(&bundle, epacket->data, sizeof(Packet::Header));
+		if(bundle.type != Packet::BUNDLE_TYPE) {
+			return false;
+		}
+
+		// Messages are a uint16 size followed by a Packet::Header and the payload
+		size_t offset = sizeof(Packet::Header);
+		while(offset + sizeof(uint16) <= epacket->dataLength) {
+			uint16 size;
+			std::memcpy(&size, epacket->data + offset, sizeof(uint16));
+			offset += sizeof(uint16);
+			if(size < sizeof(Packet::Header) || offset + size > epacket->dataLength) {
+				break; // Malformed, drop the rest
+			}
+
+			const uint8* message = epacket->data + offset;
+			offset += size;
+
+			if(handler) {
+				Packet::Header header;
+				std::memcpy(&header, message, sizeof(Packet::Header));
+				if(handler->on_receive(peer_id, header, { message + sizeof(Packet::Header), size - sizeof(Packet::Header) })) {
+					continue;
+				}
+			}
+
+			Event received = { .peer_id = peer_id, .type = EventType::Receive, .channel = channel };
+			received.packet = deserialize_packet(message, size);
+			emit(std::move(received));
+		}
+
+		enet_packet_destroy(epacket);
+		return true;
+	}
+
+	// Fills a Receive event with a packet received by ENet.
+	// Takes ownership of epacket, which is either referenced or copied and destroyed
+	inline void receive_packet(Event& event, ENetPacket* epacket, const bool zero_copy) noexcept {
+		// Should containg at least a Packet::Header
+		if(zero_copy && epacket->dataLength >= sizeof(Packet::Header)) {
+			event.ref = PacketRef(epacket);
+			return;
+		}
+
+		event.packet = deserialize_packet(epacket->data, epacket->dataLength);
+		// This data was copied to the packet
+		enet_packet_destroy(epacket);
+	}
+};
+
+
+// Coalesces small packets sent to the same peer on the same channel into one ENet packet.
+// A bundle starts with a Packet::Header of type Packet::BUNDLE_TYPE, followed by each message
+// as a uint16 size, its Packet::Header and its payload.
+// Only used by the thread servicing the host, sends reach it through the command queue, so it takes no lock.
+// Each peer and channel has one open bundle, emitted before anything that would reorder it: a message with
+// another flag, or one too big to bundle. Bundles are built in buffers kept per peer and channel,
+// the ENet packet is only allocated when one is emitted, at its final size
+class PacketAggregator {
+	public:
+		// Bundles are at most limit bytes, capped so a message size fits the uint16 prefix.
+		// peer_count is the host's peerCount
+		PacketAggregator(const size_t limit, const size_t peer_count)
+			: limit(std::min<size_t>(limit, UINT16_MAX)), peers(peer_count) {}
+
+		PacketAggregator(const PacketAggregator&) = delete;
+
+		// Largest packet the host sends in one datagram. ENet splits bigger ones into fragments and sends those reliably,
+		// so unreliable bundles are kept below it
+		static size_t unfragmented_size(const ENetHost* host) noexcept {
+			size_t size = host->mtu - sizeof(ENetProtocolHeader) - sizeof(ENetProtocolSendFragment);
+			if(host->checksum != NULL) {
+				size -= sizeof(enet_uint32);
+			}
+			return size;
+		}
+
+		// Takes ownership of epacket and appends it to the open bundle of its peer and channel.
+		// Packets are passed to emit(ENetPeer*, channel, ENetPacket*) as they must go out, in order.
+		// emit is passed nullptr when allocation fails
+		template <typename F>
+		inline void append(ENetPeer* peer, const uint8 channel, ENetPacket* epacket, F&& emit) {
+			// Out of range, let ENet reject it
+			if(channel >= peer->channelCount) {
+				emit(peer, channel, epacket);
+				return;
+			}
+
+			Bundle& bundle = this->bundle_of(peer, channel);
+			const size_t size = sizeof(uint16) + epacket->dataLength;
+
+			// Close the open bundle if this message can't join it, it goes out first
+			if(bundle.count > 0 && (bundle.flags != epacket->flags || bundle.data.size() + size > this->limit)) {
+				this->emit_bundle(bundle, emit);
+			}
+
+			// Too big for any bundle, or not a message at all
+			if(sizeof(Packet::Header) + size > this->limit || epacket->dataLength < sizeof(Packet::Header)) {
+				emit(peer, channel, epacket);
+				return;
+			}
+
+			if(bundle.count == 0) {
+				const Packet::Header header = { .id = 0, .type = Packet::BUNDLE_TYPE };
+				bundle.data.clear();
+				bundle.data.append(&header, sizeof(Packet::Header));
+				bundle.peer    = peer;
+				bundle.channel = channel;
+				bundle.flags   = epacket->flags;
+				if(!bundle.listed) {
+					bundle.listed = true;
+					this->open.push_back({ peer->incomingPeerID, channel });
+				}
+			}
+
+			const uint16 message_size = (uint16)epacket->dataLength;
+			bundle.data.append(&message_size, sizeof(uint16));
+			bundle.data.append(epacket->data, epacket->dataLength);
+			bundle.count++;
+			enet_packet_destroy(epacket);
+		}
+
+		// Passes every open bundle to emit(ENetPeer*, channel, ENetPacket*), in the order they were opened
+		template <typename F>
+		inline void flush(F&& emit) {
+			for(const auto& [index, channel] : this->open) {
+				Bundle& bundle = this->peers[index][channel];
+				bundle.listed = false;
+				if(bundle.count > 0) {
+					this->emit_bundle(bundle, emit);
+				}
+			}
+			this->open.clear();
+		}
+
+		// Passes the open bundles on one channel to emit(ENetPeer*, channel, ENetPacket*), in the order they were opened.
+		// Bundles on other channels stay open
+		template <typename F>
+		inline void flush(const uint8 channel, F&& emit) {
+			size_t kept = 0;
+			for(size_t i = 0; i < this->open.size(); i++) {
+				const auto [index, open_channel] = this->open[i];
+				if(open_channel != channel) {
+					this->open[kept++] = this->open[i];
+					continue;
+				}
+				Bundle& bundle = this->peers[index][open_channel];
+				bundle.listed = false;
+				if(bundle.count > 0) {
+					this->emit_bundle(bundle, emit);
+				}
+			}
+			this->open.resize(kept);
+		}
+
+		// Drops the open bundles of a peer that disconnected, so they don't reach the next one in its slot
+		inline void discard(ENetPeer* peer) noexcept {
+			for(Bundle& bundle : this->peers[peer->incomingPeerID]) {
+				bundle.count = 0;
+			}
+		}
+
+	private:
+		struct Bundle {
+			// Reused from bundle to bundle, it only grows up to the limit
+			PacketPayload<0> data;
+			ENetPeer* peer = nullptr;
+			uint32 flags   = 0;
+			size_t count   = 0;
+			uint8 channel  = 0;
+			// In this->open, until the next flush
+			bool listed = false;
+		};
+
+		inline Bundle& bundle_of(ENetPeer* peer, const uint8 channel) {
+			std::vector<Bundle>& channels = this->peers[peer->incomingPeerID];
+			if(channel >= channels.size()) {
+				channels.resize((size_t)channel + 1);
+			}
+			return channels[channel];
+		}
+
+		template <typename F>
+		inline void emit_bundle(Bundle& bundle, F&& emit) {
+			// A lone message goes out as a plain packet, without the bundle framing
+			const size_t offset = bundle.count == 1 ? sizeof(Packet::Header) + sizeof(uint16) : 0;
+			ENetPacket* epacket = enet_packet_create(bundle.data.data() + offset, bundle.data.size() - offset, bundle.flags);
+			bundle.count = 0;
+			emit(bundle.peer, bundle.channel, epacket);
+		}
+
+		const size_t limit;
+		// Bundles of each peer by channel, indexed like the host's peers
+		std::vector<std::vector<Bundle>> peers;
+		// Peer index and channel of the bundles opened since the last flush
+		std::vector<std::pair<uint16, uint8>> open;
+};
+
+
+// Fast LZ77 compressor in the spirit of LZ4, made for small datagrams.
+// A sequence is a token (literal count in the high nibble, match length - 4 in the low one, 15 means more bytes follow),
+// the literals, then the little endian 16 bit offset of the match. The last sequence has literals only.
+// Inputs over 64 KiB are not compressed
+class LZCompressor : public Compressor {
+	public:
+		size_t compress(std::span<const uint8> input, std::span<uint8> output) override {
+			const uint8* const in = input.data();
+			const size_t size     = input.size();
+			uint8* out            = output.data();
+			uint8* const out_end  = out + output.size();
+			if(size > UINT16_MAX) {
+				return 0;
+			}
+
+			// Positions + 1 of the last 4 bytes with each hash, 0 for none
+			this->table.fill(0);
+
+			size_t anchor = 0;
+			size_t pos    = 0;
+			while(pos + MIN_MATCH <= size) {
+				const uint32 sequence = LZCompressor::read32(in + pos);
+				const uint32 hash     = (sequence * 2654435761u) >> (32 - HASH_BITS);
+				const size_t candidate = this->table[hash];
+				this->table[hash] = (uint16)(pos + 1);
+
+				if(candidate == 0 || LZCompressor::read32(in + candidate - 1) != sequence) {
+					pos++;
+					continue;
+				}
+
+				const size_t match = candidate - 1;
+				size_t length = MIN_MATCH;
+				while(pos + length < size && in[match + length] == in[pos + length]) {
+					length++;
+				}
+
+				if(!LZCompressor::write_sequence(out, out_end, in + anchor, pos - anchor, pos - match, length)) {
+					return 0;
+				}
+				pos   += length;
+				anchor = pos;
+			}
+
+			// Whatever is left goes out as literals
+			if(!LZCompressor::write_sequence(out, out_end, in + anchor, size - anchor, 0, 0)) {
+				return 0;
+			}
+			return (size_t)(out - output.data());
+		}
+
+		size_t decompress(std::span<const uint8> input, std::span<uint8> output) override {
+			const uint8* in           = input.data();
+			const uint8* const in_end = in + input.size();
+			uint8* out                = output.data();
+			uint8* const out_end      = out + output.size();
+
+			while(in < in_end) {
+				const uint8 token = *in++;
+
+				size_t literals = token >> 4;
+				if(!LZCompressor::read_length(in, in_end, literals) || literals > (size_t)(in_end - in) || literals > (size_t)(out_end - out)) {
+					return 0;
+				}
+				if(literals > 0) {
+					std::memcpy(out, in, literals);
+				}
+				in  += literals;
+				out += literals;
+
+				// Last sequence
+				if(in == in_end) {
+					break;
+				}
+
+				if(in_end - in < 2) {
+					return 0;
+				}
+				const size_t offset = in[0] | (in[1] << 8);
+				in += 2;
+
+				size_t length = token & 0x0F;
+				if(!LZCompressor::read_length(in, in_end, length)) {
+					return 0;
+				}
+				length += MIN_MATCH;
+				if(offset == 0 || offset > (size_t)(out - output.data()) || length > (size_t)(out_end - out)) {
+					return 0;
+				}
+
+				// Byte by byte, the match may overlap what it writes
+				const uint8* match = out - offset;
+				for(size_t i = 0; i < length; i++) {
+					out[i] = match[i];
+				}
+				out += length;
+			}
+			return (size_t)(out - output.data());
+		}
+
+	private:
+		static constexpr size_t MIN_MATCH = 4;
+		static constexpr size_t HASH_BITS = 10;
+
+		static inline uint32 read32(const uint8* data) noexcept {
+			uint32 value;
+			std::memcpy(&value, data, sizeof(uint32));
+			return value;
+		}
+
+		// Bytes needed past the token to encode a length that doesn't fit its nibble
+		static inline size_t length_size(const size_t length) noexcept {
+			return length < 15 ? 0 : (length - 15) / 255 + 1;
+		}
+
+		static inline void write_length(uint8*& out, size_t length) noexcept {
+			if(length < 15) {
+				return;
+			}
+			for(length -= 15; length >= 255; length -= 255) {
+				*out++ = 255;
+			}
+			*out++ = (uint8)length;
+		}
+
+		// Adds the extra bytes of a nibble that is 15 to length. Returns false if input ends first
+		static inline bool read_length(const uint8*& in, const uint8* const in_end, size_t& length) noexcept {
+			if(length != 15) {
+				return true;
+			}
+			uint8 byte;
+			do {
+				if(in == in_end) {
+					return false;
+				}
+				byte = *in++;
+				length += byte;
+			} while(byte == 255);
+			return true;
+		}
+
+		// Writes literals followed by a match, or only the literals if match_length is 0.
+		// Returns false if it doesn't fit
+		static inline bool write_sequence(uint8*& out, uint8* const out_end, const uint8* literals, const size_t literal_count,
+			const size_t offset, const size_t match_length) noexcept {
+			const size_t match_code = match_length == 0 ? 0 : match_length - MIN_MATCH;
+			const size_t needed = 1 + LZCompressor::length_size(literal_count) + literal_count
+				+ (match_length == 0 ? 0 : 2 + LZCompressor::length_size(match_code));
+			if(needed > (size_t)(out_end - out)) {
+				return false;
+			}
+
+			*out++ = (uint8)((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15));
+			LZCompressor::write_length(out, literal_count);
+			if(literal_count > 0) {
+				std::memcpy(out, literals, literal_count);
+			}
+			out += literal_count;
+
+			if(match_length != 0) {
+				*out++ = (uint8)(offset & 0xFF);
+				*out++ = (uint8)(offset >> 8);
+				LZCompressor::write_length(out, match_code);
+			}
+			return true;
+		}
+
+		std::array<uint16, 1 << HASH_BITS> table;
+};
+
+
+// Plugs a Compressor into an ENet host and counts what goes through it.
+// Owned by the Server or Client, which must destroy the host first
+class HostCompressor {
+	public:
+		// Uses compressor, or the built-in LZCompressor if it is nullptr
+		explicit HostCompressor(Compressor* compressor) noexcept
+			: compressor(compressor ? compressor : &this->builtin) {}
+
+		HostCompressor(const HostCompressor&) = delete;
+
+		inline void attach(ENetHost* host) noexcept {
+			ENetCompressor callbacks = {
+				.context    = this,
+				.compress   = &HostCompressor::compress_callback,
+				.decompress = &HostCompressor::decompress_callback,
+				.destroy    = NULL // Owned here, not by the host
+			};
+			enet_host_compress(host, &callbacks);
+		}
+
+		// Safe to call from any thread
+		inline CompressionStats stats() const noexcept {
+			return CompressionStats {
+				.datagrams  = this->datagrams.load(std::memory_order_relaxed),
+				.compressed = this->compressed.load(std::memory_order_relaxed),
+				.bytes_in   = this->bytes_in.load(std::memory_order_relaxed),
+				.bytes_out  = this->bytes_out.load(std::memory_order_relaxed),
+				.received   = this->received.load(std::memory_order_relaxed),
+				.failures   = this->failures.load(std::memory_order_relaxed)
+			};
+		}
+
+	private:
+		static size_t ENET_CALLBACK compress_callback(void* context, const ENetBuffer* buffers, size_t buffer_count,
+			size_t limit, enet_uint8* out, size_t out_limit) {
+			HostCompressor* self = static_cast<HostCompressor*>(context);
+			if(limit > self->scratch.size()) {
+				return 0;
+			}
+
+			// ENet hands the datagram over in pieces, the compressor wants it contiguous
+			size_t size = 0;
+			for(size_t i = 0; i < buffer_count && size < limit; i++) {
+				const size_t length = std::min(buffers[i].dataLength, limit - size);
+				std::memcpy(self->scratch.data() + size, buffers[i].data, length);
+				size += length;
+			}
+
+			const size_t result = self->compressor->compress({ self->scratch.data(), size }, { out, out_limit });
+			// ENet sends it uncompressed unless it got smaller
+			const bool smaller = result > 0 && result < size;
+			self->datagrams.fetch_add(1, std::memory_order_relaxed);
+			self->compressed.fetch_add(smaller, std::memory_order_relaxed);
+			self->bytes_in.fetch_add(size, std::memory_order_relaxed);
+			self->bytes_out.fetch_add(smaller ? result : size, std::memory_order_relaxed);
+			return result;
+		}
+
+		static size_t ENET_CALLBACK decompress_callback(void* context, const enet_uint8* in, size_t in_limit,
+			enet_uint8* out, size_t out_limit) {
+			HostCompressor* self = static_cast<HostCompressor*>(context);
+			const size_t result = self->compressor->decompress({ in, in_limit }, { out, out_limit });
+			self->received.fetch_add(1, std::memory_order_relaxed);
+			self->failures.fetch_add(result == 0, std::memory_order_relaxed);
+			return result;
+		}
+
+		LZCompressor builtin;
+		Compressor* compressor;
+		// Only touched by the thread servicing the host
+		std::array<uint8, ENET_PROTOCOL_MAXIMUM_MTU> scratch;
+
+		// Written by the thread servicing the host, read by stats()
+		std::atomic<uint64_t> datagrams  = 0;
+		std::atomic<uint64_t> compressed = 0;
+		std::atomic<uint64_t> bytes_in   = 0;
+		std::atomic<uint64_t> bytes_out  = 0;
+		std::atomic<uint64_t> received   = 0;
+		std::atomic<uint64_t> failures   = 0;
+};
+
+
+// Size used to pad atomics so threads updating them don't share a cache line
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+
+// Counters of the PoolAllocator. Only its slow paths are counted
+struct PoolStats {
+	// Slabs carved from the system allocator, and their total size
+	uint64_t slabs          = 0;
+	uint64_t bytes_reserved = 0;
+	// Times a thread cache ran dry and took blocks from the shared lists
+	uint64_t refills = 0;
+	// Times a thread cache overflowed and gave blocks back to the shared lists
+	uint64_t releases = 0;
+	// Allocations larger than the largest size class, passed to malloc
+	uint64_t large_allocations = 0;
+};
+
+
+// Size class allocator ENet allocates its packets, commands and acknowledgements from,
+// when built with SCARABNET_POOL_ALLOCATOR.
+// Each thread frees to and allocates from its own cache without synchronization. Caches trade batches of blocks
+// with per class shared lists, lock-free stacks of batches, so threads never wait on each other.
+// This also covers packets built on the application thread and freed by the network thread once delivered.
+// Memory is kept for reuse and never given back to the system
+class PoolAllocator {
+	public:
+		// The process wide allocator. Never destroyed, ENet may free into it until the very end
+		static inline PoolAllocator& instance() noexcept {
+			static PoolAllocator* const allocator = new PoolAllocator();
+			return *allocator;
+		}
+
+		PoolAllocator(const PoolAllocator&) = delete;
+
+		inline void* allocate(const size_t size) noexcept {
+			const size_t size_class = PoolAllocator::class_of(size);
+			if(size_class == LARGE) {
+				return this->allocate_large(size);
+			}
+
+			ThreadCache* cache = PoolAllocator::thread_cache();
+			Block* block = nullptr;
+			if(cache == nullptr) {
+				// Thread is exiting, its cache is gone. Take one block and put the rest of its batch back
+				Block* batch[BATCH];
+				const size_t count = this->take(size_class, batch);
+				if(count > 0) {
+					block = batch[0];
+					this->give(size_class, batch + 1, count - 1);
+				}
+			} else {
+				if(cache->counts[size_class] == 0) {
+					cache->counts[size_class] = (uint32)this->take(size_class, cache->blocks[size_class]);
+				}
+				if(cache->counts[size_class] > 0) {
+					block = cache->blocks[size_class][--cache->counts[size_class]];
+				}
+			}
+
+			// Out of slabs for this class
+			if(block == nullptr) {
+				return this->allocate_large(size);
+			}
+			block->size_class = (uint32)size_class;
+			return reinterpret_cast<uint8*>(block) + HEADER_SIZE;
+		}
+
+		inline void deallocate(void* memory) noexcept {
+			if(memory == nullptr) {
+				return;
+			}
+
+			Block* block = reinterpret_cast<Block*>(static_cast<uint8*>(memory) - HEADER_SIZE);
+			const size_t size_class = block->size_class;
+			if(size_class == LARGE) {
+				std::free(block);
+				return;
+			}
+
+			ThreadCache* cache = PoolAllocator::thread_cache();
+			if(cache == nullptr) {
+				this->give(size_class, &block, 1);
+				return;
+			}
+
+			uint32& count = cache->counts[size_class];
+			cache->blocks[size_class][count++] = block;
+			// Too many idle blocks here, hand a batch to the threads that allocate
+			if(count == 2 * BATCH) {
+				count -= BATCH;
+				this->give(size_class, cache->blocks[size_class] + count, BATCH);
+			}
+		}
+
+		// Safe to call from any thread
+		inline PoolStats stats() const noexcept {
+			return PoolStats {
+				.slabs             = this->slabs.load(std::memory_order_relaxed),
+				.bytes_reserved    = this->bytes_reserved.load(std::memory_order_relaxed),
+				.refills           = this->refills.load(std::memory_order_relaxed),
+				.releases          = this->releases.load(std::memory_order_relaxed),
+				.large_allocations = this->large_allocations.load(std::memory_order_relaxed)
+			};
+		}
+
+	private:
+		// Blocks are 32 << class bytes, header included
+		static constexpr size_t CLASS_COUNT = 9;
+		static constexpr size_t MIN_BLOCK   = 32;
+		static constexpr size_t LARGE       = CLASS_COUNT;
+		// Blocks moved between a thread cache and the shared list at once
+		static constexpr size_t BATCH = 32;
+		static constexpr size_t SLAB_SIZE = 64 * 1024;
+		// Slabs a class can carve, 256 MiB of 64 KiB slabs. Past that it falls back to malloc
+		static constexpr size_t MAX_SLABS = 4096;
+		// Keeps what follows 16 byte aligned
+		static constexpr size_t HEADER_SIZE = 16;
+
+		// Header of every allocation.
+		// Blocks are named by their index in their class instead of a pointer, so a shared list head fits
+		// a 32 bit index next to a 32 bit counter in one lock-free 64 bit word
+		struct Block {
+			// Class of an allocated block, number of blocks in the batch it heads while in a shared list
+			uint32 size_class;
+			// Position among the blocks of its class, fixed when carved
+			uint32 index;
+			// Index + 1 of the next block of its batch, while in a shared list
+			uint32 next;
+			// Index + 1 of the next batch of the shared list while heading a batch.
+			// Read by threads racing to pop it, so only accessed atomically
+			uint32 next_batch;
+		};
+		static_assert(sizeof(Block) == HEADER_SIZE);
+
+		struct ThreadCache {
+			Block* blocks[CLASS_COUNT][2 * BATCH];
+			uint32 counts[CLASS_COUNT] = {};
+
+			~ThreadCache() {
+				// Frees made by thread_local destructors running after this one go to the shared lists
+				PoolAllocator::thread_exited = true;
+				PoolAllocator& allocator = PoolAllocator::instance();
+				for(size_t i = 0; i < CLASS_COUNT; i++) {
+					allocator.give(i, this->blocks[i], this->counts[i]);
+				}
+			}
+		};
+
+		// Stack of free batches of one class, plus the slabs its blocks come from
+		struct SharedList {
+			// Index + 1 of the top batch in the low 32 bits, 0 when empty.
+			// The high 32 bits count every change, so a head popped and pushed back in between
+			// makes a stale compare and swap fail (ABA)
+			alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head = 0;
+			std::atomic<uint32> slab_count = 0;
+			std::atomic<uint8*> slabs[MAX_SLABS] = {};
+		};
+
+		PoolAllocator() = default;
+
+		// Returns nullptr once the calling thread destroyed its cache
+		static inline ThreadCache* thread_cache() noexcept {
+			if(PoolAllocator::thread_exited) {
+				return nullptr;
+			}
+			thread_local ThreadCache cache;
+			return &cache;
+		}
+
+		// Trivially destructible, so it can still be read after the cache is gone
+		static inline thread_local bool thread_exited = false;
+
+		static inline size_t class_of(const size_t size) noexcept {
+			size_t block = MIN_BLOCK;
+			for(size_t i = 0; i < CLASS_COUNT; i++, block <<= 1) {
+				if(size + HEADER_SIZE <= block) {
+					return i;
+				}
+			}
+			return LARGE;
+		}
+
+		static constexpr size_t block_size(const size_t size_class) noexcept {
+			return MIN_BLOCK << size_class;
+		}
+
+		// Big classes still get a whole batch per slab
+		static constexpr size_t slab_size(const size_t size_class) noexcept {
+			return std::max(SLAB_SIZE, block_size(size_class) * BATCH);
+		}
+
+		// Blocks per slab are a power of two, so an index splits into slab and offset with a shift
+		static constexpr uint32 slab_shift(const size_t size_class) noexcept {
+			return (uint32)std::countr_zero(slab_size(size_class) / block_size(size_class));
+		}
+
+		inline void* allocate_large(const size_t size) noexcept {
+			Block* block = static_cast<Block*>(std::malloc(HEADER_SIZE + size));
+			if(block == nullptr) {
+				return nullptr;
+			}
+			block->size_class = LARGE;
+			this->large_allocations.fetch_add(1, std::memory_order_relaxed);
+			return reinterpret_cast<uint8*>(block) + HEADER_SIZE;
+		}
+
+		inline Block* block_at(const size_t size_class, const uint32 index) const noexcept {
+			const uint32 shift = PoolAllocator::slab_shift(size_class);
+			uint8* slab = this->shared[size_class].slabs[index >> shift].load(std::memory_order_relaxed);
+			return reinterpret_cast<Block*>(slab + (size_t)(index & ((1u << shift) - 1)) * block_size(size_class));
+		}
+
+		// Pops a batch from the shared list into blocks, carving a slab if it is empty.
+		// Returns the number of blocks, 0 if no slab could be carved
+		inline size_t take(const size_t size_class, Block** blocks) noexcept {
+			this->refills.fetch_add(1, std::memory_order_relaxed);
+			SharedList& shared = this->shared[size_class];
+
+			uint64_t head = shared.head.load(std::memory_order_acquire);
+			Block* batch = nullptr;
+			while((uint32)head != 0) {
+				batch = this->block_at(size_class, (uint32)head - 1);
+				// May already be popped and reused by another thread, then the swap below fails
+				const uint32 next = std::atomic_ref<uint32>(batch->next_batch).load(std::memory_order_relaxed);
+				const uint64_t popped = ((head >> 32) + 1) << 32 | next;
+				if(shared.head.compare_exchange_weak(head, popped, std::memory_order_acquire, std::memory_order_acquire)) {
+					break;
+				}
+				batch = nullptr;
+			}
+
+			if(batch == nullptr) {
+				return this->carve(size_class, blocks);
+			}
+
+			// The batch is ours now, walk its links
+			const size_t count = batch->size_class;
+			blocks[0] = batch;
+			for(size_t i = 1; i < count; i++) {
+				blocks[i] = this->block_at(size_class, blocks[i - 1]->next - 1);
+			}
+			return count;
+		}
+
+		// Pushes count blocks on the shared list as one batch
+		inline void give(const size_t size_class, Block** blocks, const size_t count) noexcept {
+			if(count == 0) {
+				return;
+			}
+			this->releases.fetch_add(1, std::memory_order_relaxed);
+
+			for(size_t i = 0; i + 1 < count; i++) {
+				blocks[i]->next = blocks[i + 1]->index + 1;
+			}
+			Block* batch = blocks[0];
+			batch->size_class = (uint32)count;
+
+			SharedList& shared = this->shared[size_class];
+			uint64_t head = shared.head.load(std::memory_order_relaxed);
+			uint64_t pushed;
+			do {
+				std::atomic_ref<uint32>(batch->next_batch).store((uint32)head, std::memory_order_relaxed);
+				pushed = ((head >> 32) + 1) << 32 | (batch->index + 1);
+			} while(!shared.head.compare_exchange_weak(head, pushed, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		// Splits a new slab into batches, the first one into blocks and the others on the shared list.
+		// Returns the number of blocks in blocks, 0 if the class is out of slabs or malloc failed
+		inline size_t carve(const size_t size_class, Block** blocks) noexcept {
+			SharedList& shared = this->shared[size_class];
+			uint32 slab_index = shared.slab_count.load(std::memory_order_relaxed);
+			do {
+				if(slab_index >= MAX_SLABS) {
+					return 0;
+				}
+			} while(!shared.slab_count.compare_exchange_weak(slab_index, slab_index + 1, std::memory_order_relaxed));
+
+			const size_t size = slab_size(size_class);
+			uint8* slab = static_cast<uint8*>(std::malloc(size));
+			if(slab == nullptr) {
+				// The slot stays empty, its indices are never handed out
+				return 0;
+			}
+			// Published to other threads by the release of the pushes below
+			shared.slabs[slab_index].store(slab, std::memory_order_relaxed);
+
+			const size_t count = size / block_size(size_class);
+			const uint32 first = slab_index << slab_shift(size_class);
+			for(size_t i = 0; i < count; i++) {
+				Block* block = reinterpret_cast<Block*>(slab + i * block_size(size_class));
+				block->index = first + (uint32)i;
+			}
+
+			for(size_t i = 0; i < count; i += BATCH) {
+				Block* batch[BATCH];
+				for(size_t j = 0; j < BATCH; j++) {
+					batch[j] = reinterpret_cast<Block*>(slab + (i + j) * block_size(size_class));
+				}
+				if(i == 0) {
+					std::copy(batch, batch + BATCH, blocks);
+				} else {
+					this->give(size_class, batch, BATCH);
+				}
+			}
+
+			this->slabs.fetch_add(1, std::memory_order_relaxed);
+			this->bytes_reserved.fetch_add(size, std::memory_order_relaxed);
+			return BATCH;
+		}
+
+		std::array<SharedList, CLASS_COUNT> shared;
+
+		std::atomic<uint64_t> slabs             = 0;
+		std::atomic<uint64_t> bytes_reserved    = 0;
+		std::atomic<uint64_t> refills           = 0;
+		std::atomic<uint64_t> releases          = 0;
+		std::atomic<uint64_t> large_allocations = 0;
+};
+
+
+// Initializes ENet for one host, allocating from the PoolAllocator when built with SCARABNET_POOL_ALLOCATOR.
+// Returns 0 on success like enet_initialize. Every success must be paired with deinitialize_enet()
+inline int initialize_enet() noexcept {
+#ifdef SCARABNET_POOL_ALLOCATOR
+	// ENet's callbacks are global, set them once for every host.
+	// Setting them also initializes ENet, undone right away so each host does its own balanced pair
+	static const bool callbacks_set = []() {
+		ENetCallbacks callbacks = {};
+		callbacks.malloc = [](size_t size) -> void* {
+			return PoolAllocator::instance().allocate(size);
+		};
+		callbacks.free = [](void* memory) {
+			PoolAllocator::instance().deallocate(memory);
+		};
+		if(enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0) {
+			return false;
+		}
+		enet_deinitialize();
+		return true;
+	}();
+	if(!callbacks_set) {
+		return -1;
+	}
+#endif
+	return enet_initialize();
+}
+
+// Undoes one successful initialize_enet(), once its host is destroyed
+inline void deinitialize_enet() noexcept {
+	enet_deinitialize();
+}
+
+
+template <typename T>
+class TSQueue {
+	public:
+		TSQueue() = default;
+		TSQueue(const TSQueue<T>&) = delete;
+		virtual ~TSQueue() {
+			this->clear();
+		}
+
+		// Returns item at front of queue
+		inline const T& front() const noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			return this->queue.front();
+		}
+
+		// Returns item at back of queue
+		inline const T& back() const noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			return this->queue.back();
+		}
+
+		// Adds an item to back of queue
+		inline void push_back(const T& item) noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			this->queue.push_back(std::move(item));
+		}
+
+		// Adds an item to back of queue
+		inline void push_back(T&& item) noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			this->queue.push_back(std::move(item));
+		}
+
+		// Adds an item to back of queue
+		inline void push_front(const T& item) noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			this->queue.push_front(std::move(item));
+		}
+
+		// Adds an item to back of queue
+		inline void push_front(T&& item) noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			this->queue.push_front(std::move(item));
+		}
+
+		// Returns true if queue has no items
+		inline bool empty() const noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			return this->queue.empty();
+		}
+
+		// Returns number of items in queue
+		inline size_t count() const noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			return this->queue.count();
+		}
+
+		// Clear queue
+		inline void clear() noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			return this->queue.clear();
+		}
+
+		// Removes and returns item from front of queue
+		inline T pop_front() noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			T t = std::move(this->queue.front());
+			this->queue.pop_front();
+			return t;
+		}
+
+		// Removes and returns item from back of queue
+		inline T pop_back() noexcept {
+			std::scoped_lock lock = std::scoped_lock(this->mux);
+			T t = std::move(this->queue.back());
+			this->queue.pop_front();
+			return t;
+		}
+
+	private:
+		mutable std::mutex mux;
+		std::deque<T> queue;
+};
+
+
+// Default capacity of the event queue between the network thread and the application
+#ifndef SCARABNET_EVENT_QUEUE_CAPACITY
+#define SCARABNET_EVENT_QUEUE_CAPACITY 4096
+#endif
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Used by default to hand events from the network thread to the application thread.
+// Capacity must be a power of two
+template <typename T, size_t Capacity = SCARABNET_EVENT_QUEUE_CAPACITY>
+class SPSCQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+		"SPSCQueue capacity must be a power of two");
+
+	public:
+		SPSCQueue() : slots(std::make_unique<T[]>(Capacity)) {}
+		SPSCQueue(const SPSCQueue<T, Capacity>&) = delete;
+		~SPSCQueue() = default;
+
+		// Adds an item to back of queue.
+		// Returns false if the queue is full, in which case item is left untouched.
+		// Must only be called from the producer thread
+		inline bool push_back(T&& item) noexcept {
+			const size_t tail = this->tail.load(std::memory_order_relaxed);
+			if(tail - this->cached_head == Capacity) {
+				// Looks full, refresh the consumer index and check again
+				this->cached_head = this->head.load(std::memory_order_acquire);
+				if(tail - this->cached_head == Capacity) {
+					return false;
+				}
+			}
+
+			this->slots[tail & MASK] = std::move(item);
+			this->tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Removes item from front of queue and moves it into item.
+		// Returns false if the queue is empty.
+		// Must only be called from the consumer thread
+		inline bool pop_front(T& item) noexcept {
+			const size_t head = this->head.load(std::memory_order_relaxed);
+			if(head == this->cached_tail) {
+				// Looks empty, refresh the producer index and check again
+				this->cached_tail = this->tail.load(std::memory_order_acquire);
+				if(head == this->cached_tail) {
+					return false;
+				}
+			}
+
+			item = std::move(this->slots[head & MASK]);
+			this->head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Removes up to max items from front of queue, passing each one to fn(T&&).
+		// Items are claimed with a single index update, returns how many were removed.
+		// Must only be called from the consumer thread
+		template <typename F>
+		inline size_t pop_bulk(const size_t max, F&& fn) {
+			const size_t head = this->head.load(std::memory_order_relaxed);
+			this->cached_tail = this->tail.load(std::memory_order_acquire);
+
+			const size_t n = std::min(max, this->cached_tail - head);
+			for(size_t i = 0; i < n; i++) {
+				fn(std::move(this->slots[(head + i) & MASK]));
+			}
+
+			if(n > 0) {
+				this->head.store(head + n, std::memory_order_release);
+			}
+			return n;
+		}
+
+		// Returns true if queue has no items
+		inline bool empty() const noexcept {
+			return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+		}
+
+		// Returns number of items in queue
+		inline size_t count() const noexcept {
+			return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+		}
+
+		// Returns the maximum number of items the queue can hold
+		static constexpr size_t capacity() noexcept {
+			return Capacity;
+		}
+
+		// Removes all items. Must only be called from the consumer thread
+		inline void clear() noexcept {
+			T item;
+			while(this->pop_front(item)) {}
+		}
+
+	private:
+		static constexpr size_t MASK = Capacity - 1;
+
+		// Consumer side
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> head = 0;
+		size_t cached_tail = 0; // Last tail seen by the consumer
+
+		// Producer side
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail = 0;
+		size_t cached_head = 0; // Last head seen by the producer
+
+		alignas(CACHE_LINE_SIZE) std::unique_ptr<T[]> slots;
+};
+
+
+// Default capacity of the command queue between application threads and the network thread
+#ifndef SCARABNET_COMMAND_QUEUE_CAPACITY
+#define SCARABNET_COMMAND_QUEUE_CAPACITY 4096
+#endif
+
+// Bounded lock-free queue for many producer threads and one consumer thread.
+// Used to hand commands from application threads to the network thread.
+// Each slot carries a sequence number telling whether it is ready to be written or read,
+// producers claim slots with a single CAS on the tail.
+// Capacity must be a power of two
+template <typename T, size_t Capacity = SCARABNET_COMMAND_QUEUE_CAPACITY>
+class MPSCQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+		"MPSCQueue capacity must be a power of two");
+
+	public:
+		MPSCQueue() : cells(std::make_unique<Cell[]>(Capacity)) {
+			for(size_t i = 0; i < Capacity; i++) {
+				this->cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+		MPSCQueue(const MPSCQueue<T, Capacity>&) = delete;
+		~MPSCQueue() = default;
+
+		// Adds an item to back of queue.
+		// Returns false if the queue is full, in which case item is left untouched.
+		// Safe to call from any thread
+		inline bool push_back(T&& item) noexcept {
+			size_t pos = this->tail.load(std::memory_order_relaxed);
+			Cell* cell;
+			while(true) {
+				cell = &this->cells[pos & MASK];
+				const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				const intptr_t diff   = (intptr_t)sequence - (intptr_t)pos;
+
+				if(diff == 0) {
+					// Slot is free, try to claim it
+					if(this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if(diff < 0) {
+					// Slot still holds an item from the previous lap
+					return false;
+				} else {
+					// Another producer claimed it first
+					pos = this->tail.load(std::memory_order_relaxed);
+				}
+			}
+
+			cell->item = std::move(item);
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Removes item from front of queue and moves it into item.
+		// Returns false if the queue is empty.
+		// Must only be called from the consumer thread
+		inline bool pop_front(T& item) noexcept {
+			Cell& cell = this->cells[this->head & MASK];
+			if(cell.sequence.load(std::memory_order_acquire) != this->head + 1) {
+				return false;
+			}
+
+			item = std::move(cell.item);
+			// Hand the slot back to producers for the next lap
+			cell.sequence.store(this->head + Capacity, std::memory_order_release);
+			this->head++;
+			return true;
+		}
+
+		// Returns true if queue has no items
+		inline bool empty() const noexcept {
+			return this->cells[this->head & MASK].sequence.load(std::memory_order_acquire) != this->head + 1;
+		}
+
+		// Returns the maximum number of items the queue can hold
+		static constexpr size_t capacity() noexcept {
+			return Capacity;
+		}
+
+	private:
+		static constexpr size_t MASK = Capacity - 1;
+
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T item;
+		};
+
+		// Producers side
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail = 0;
+		// Consumer side, only touched by the consumer thread
+		alignas(CACHE_LINE_SIZE) size_t head = 0;
+
+		alignas(CACHE_LINE_SIZE) std::unique_ptr<Cell[]> cells;
+};
+
+
+// Maps client ids to connected peers, backed by a contiguous array indexed by ENet's incomingPeerID.
+// An id is (generation << 16) | index. The generation is bumped every time a slot is freed,
+// so the id of a disconnected client never resolves to the client that reuses its slot.
+// Lookups are an index and a compare, no hashing
+class PeerSlotMap {
+	public:
+		// Number of ENet peers the map must hold, the host's peerCount.
+		// Ids are offset by base, so maps of several hosts can share one id space
+		inline void resize(const size_t count, const uint16 base = 0) {
+			this->slots.resize(count);
+			this->active.reserve(count);
+			this->base = base;
+		}
+
+		// Adds a connected peer, returns its id
+		inline uint32 insert(ENetPeer* peer) noexcept {
+			const uint16 index = peer->incomingPeerID;
+			Slot& slot = this->slots[index];
+			slot.peer     = peer;
+			slot.position = (uint32)this->active.size();
+			this->active.push_back(index);
+			return ((uint32)slot.generation << 16) | (uint32)(this->base + index);
+		}
+
+		// Returns the peer with this id, or nullptr if it disconnected
+		inline ENetPeer* find(const uint32 id) const noexcept {
+			const uint32 index = (id & 0xFFFF) - this->base; // Wraps around below base
+			if(index >= this->slots.size()) {
+				return nullptr;
+			}
+			const Slot& slot = this->slots[index];
+			return slot.generation == (id >> 16) ? slot.peer : nullptr;
+		}
+
+		// Removes a peer, its id becomes invalid
+		inline void erase(const uint32 id) noexcept {
+			if(this->find(id) == nullptr) {
+				return;
+			}
+
+			Slot& slot = this->slots[(id & 0xFFFF) - this->base];
+			// Swap with the last active slot to keep the active list dense
+			const uint16 last = this->active.back();
+			this->active[slot.position] = last;
+			this->slots[last].position  = slot.position;
+			this->active.pop_back();
+
+			slot.peer = nullptr;
+			// Generation 0 is skipped so no id is ever 0, which clients use for the server
+			slot.generation = slot.generation == 0xFFFF ? 1 : slot.generation + 1;
+		}
+
+		// Calls fn(id, peer) for every connected peer
+		template <typename F>
+		inline void for_each(F&& fn) const {
+			for(const uint16 index : this->active) {
+				const Slot& slot = this->slots[index];
+				fn(((uint32)slot.generation << 16) | (uint32)(this->base + index), slot.peer);
+			}
+		}
+
+		// Number of connected peers
+		inline size_t size() const noexcept {
+			return this->active.size();
+		}
+
+	private:
+		struct Slot {
+			ENetPeer* peer    = nullptr;
+			uint32 position   = 0; // Position in this->active
+			uint16 generation = 1;
+		};
+
+		std::vector<Slot> slots;
+		// Indices of occupied slots, for cache friendly iteration
+		std::vector<uint16> active;
+		// Added to slot indices to form ids
+		uint16 base = 0;
+};
+
+
+// Removes the first occurrence of id from ids, not keeping their order
+inline void remove_id(std::vector<uint32>& ids, const uint32 id) noexcept {
+	auto found = std::find(ids.begin(), ids.end(), id);
+	if(found != ids.end()) {
+		*found = ids.back();
+		ids.pop_back();
+	}
+}
+
+
+// Work handed from application threads to the network thread,
+// so ENet is only ever touched by the thread servicing it
+struct Command {
+	enum class Type : uint8 {
+		None = 0,
+		Send,
+		Broadcast,
+		Disconnect,
+		Flush,
+		CreateGroup,
+		Join,
+		Leave,
+		DestroyGroup,
+		GroupSend
+	};
+
+	Type type = Type::None;
+	// Target of Send and Disconnect, member of Join and Leave, client skipped by GroupSend (0 for none)
+	uint32 peer_id = 0;
+	// Channel of Send, Broadcast and GroupSend
+	uint8 channel = 0;
+	// Group of CreateGroup, Join, Leave, DestroyGroup and GroupSend
+	uint32 group_id = 0;
+	// Owned by the command until the network thread hands it to ENet
+	ENetPacket* packet = nullptr;
+};
+
+
+
+// A pollable file descriptor that any thread can make readable.
+// An eventfd on Linux and a pipe on other POSIX systems, unavailable on Windows
+class WakeFd {
+	public:
+		WakeFd() {
+		#if defined(__linux__)
+			this->fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			this->fds[1] = this->fds[0];
+			if(this->fds[0] < 0) {
+				throw std::runtime_error("Failed to create eventfd");
+			}
+		#elif !defined(_WIN32)
+			if(pipe(this->fds) != 0) {
+				throw std::runtime_error("Failed to create pipe");
+			}
+			for(const int fd : this->fds) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+			}
+		#endif
+		}
+
+		WakeFd(const WakeFd&) = delete;
+
+		~WakeFd() noexcept {
+		#ifndef _WIN32
+			close(this->fds[0]);
+			if(this->fds[1] != this->fds[0]) {
+				close(this->fds[1]);
+			}
+		#endif
+		}
+
+		// Descriptor to poll for readability, -1 on Windows
+		inline int fd() const noexcept {
+			return this->fds[0];
+		}
+
+		// Makes fd() readable
+		inline void signal() noexcept {
+		#ifndef _WIN32
+			const uint64_t one = 1;
+			[[maybe_unused]] const ssize_t n = write(this->fds[1], &one, sizeof(one));
+		#endif
+		}
+
+		// Makes fd() not readable anymore
+		inline void drain() noexcept {
+		#ifndef _WIN32
+			uint64_t buffer[8];
+			while(read(this->fds[0], buffer, sizeof(buffer)) > 0) {}
+		#endif
+		}
+
+	private:
+		// Read and write ends, the same descriptor for an eventfd
+		int fds[2] = { -1, -1 };
+};
+
+
+// Lets application threads interrupt the network thread while it sleeps on the ENet socket.
+// notify() only makes a syscall when the network thread is actually sleeping
+class Waker {
+	public:
+		// Wakes the network thread if it's sleeping. Safe to call from any thread
+		inline void notify() noexcept {
+		#ifndef _WIN32
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			// Only the first notifier after the thread went to sleep pays for the syscall
+			if(this->sleeping.exchange(false, std::memory_order_seq_cst)) {
+				this->wake_fd.signal();
+			}
+		#endif
+		}
+
+		// Sleeps until socket is readable, notify() is called or timeout milliseconds pass.
+		// has_work is checked after announcing the sleep, so work queued right before isn't missed
+		template <typename F>
+		inline void wait(const ENetSocket socket, const uint32 timeout, F&& has_work) noexcept {
+		#ifdef _WIN32
+			// No wake handle, wait on the socket alone
+			if(has_work()) {
+				return;
+			}
+			enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+			enet_socket_wait(socket, &condition, timeout);
+		#else
+			this->sleeping.store(true, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(has_work()) {
+				this->sleeping.store(false, std::memory_order_relaxed);
+				return;
+			}
+
+			pollfd fds[2] = {
+				{ .fd = socket,              .events = POLLIN, .revents = 0 },
+				{ .fd = this->wake_fd.fd(), .events = POLLIN, .revents = 0 }
+			};
+			poll(fds, 2, (int)timeout);
+			this->sleeping.store(false, std::memory_order_relaxed);
+
+			// Reset the wake handle
+			if(fds[1].revents & POLLIN) {
+				this->wake_fd.drain();
+			}
+		#endif
+		}
+
+	private:
+		std::atomic<bool> sleeping = false;
+		WakeFd wake_fd;
+};
+
+
+// Lets the application thread sleep until the network thread pushes an event,
+// or poll a descriptor for it from an external event loop.
+// notify() only takes the lock when a thread is actually waiting
+class EventSignal {
+	public:
+		// Wakes the waiting thread, if any. Called after pushing an event
+		inline void notify() noexcept {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(this->waiting.load(std::memory_order_seq_cst)) {
+				std::scoped_lock lock = std::scoped_lock(this->mux);
+				this->cv.notify_all();
+			}
+			this->signal_fd();
+		}
+
+		// Sleeps until ready() returns true or deadline passes.
+		// Returns the last result of ready()
+		template <typename Clock, typename Duration, typename F>
+		inline bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline, F&& ready) {
+			if(ready()) {
+				return true;
+			}
+
+			std::unique_lock lock = std::unique_lock(this->mux);
+			this->waiting.store(true, std::memory_order_seq_cst);
+			// Pairs with the fence in notify(), so an event pushed before this point is seen by ready()
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const bool result = this->cv.wait_until(lock, deadline, ready);
+			this->waiting.store(false, std::memory_order_relaxed);
+			return result;
+		}
+
+		// Returns a descriptor that is readable while ready() would return true.
+		// Created on first call, must be called from the consumer thread
+		template <typename F>
+		inline int fd(F&& ready) {
+			if(!this->readiness) {
+				this->readiness = std::make_unique<WakeFd>();
+				this->readiness_fd.store(this->readiness.get(), std::memory_order_seq_cst);
+				// Events pushed before the descriptor existed
+				if(ready()) {
+					this->signal_fd();
+				}
+			}
+			return this->readiness->fd();
+		}
+
+		// Clears the descriptor from fd() once ready() turns false.
+		// Called by the consumer after taking events
+		template <typename F>
+		inline void reset_fd(F&& ready) noexcept {
+			// Also covers fd() never being requested
+			if(!this->fd_signaled.load(std::memory_order_acquire) || ready()) {
+				return;
+			}
+
+			this->fd_signaled.store(false, std::memory_order_seq_cst);
+			this->readiness->drain();
+			// An event may have been pushed while the flag was still set, don't lose it
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(ready()) {
+				this->signal_fd();
+			}
+		}
+
+	private:
+		// Makes the fd() descriptor readable, once per empty to non-empty transition
+		inline void signal_fd() noexcept {
+			WakeFd* wake_fd = this->readiness_fd.load(std::memory_order_acquire);
+			if(wake_fd && !this->fd_signaled.load(std::memory_order_relaxed) &&
+				!this->fd_signaled.exchange(true, std::memory_order_seq_cst)) {
+				wake_fd->signal();
+			}
+		}
+
+		std::atomic<bool> waiting = false;
+		std::mutex mux;
+		std::condition_variable cv;
+
+		// Readiness descriptor, only allocated when requested
+		std::unique_ptr<WakeFd> readiness;
+		std::atomic<WakeFd*> readiness_fd = nullptr;
+		std::atomic<bool> fd_signaled = false;
 };
 
 } // -- END NAMESPACE
@@ -35,8 +35,14 @@
 #ifndef ENET_INCLUDE_H
 #define ENET_INCLUDE_H
 
+// recvmmsg/sendmmsg are GNU extensions, only declared if this comes before the first system header
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
 #include <assert.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
@@ -166,6 +172,24 @@
     #define MSG_NOSIGNAL 0
     #endif
 
+    // recvmmsg/sendmmsg, see enet_host_socket_batch. Unavailable if a system header came before
+    // enet.h without _GNU_SOURCE, enet_host_socket_batch then fails instead of batching
+    #if defined(__linux__) && (defined(__USE_GNU) || !defined(__GLIBC__))
+    #define ENET_SOCKET_BATCH 1
+    #endif
+
+    // io_uring with provided buffer rings and multishot recvmsg, see enet_host_socket_uring
+    #if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+    #define ENET_SOCKET_URING 1
+    #endif
+    #endif
+    #endif
+
     #ifdef MSG_MAXIOVLEN
     #define ENET_BUFFER_MAXIMUM MSG_MAXIOVLEN
     #endif
@@ -517,6 +541,7 @@ extern "C" {
         ENET_SOCKOPT_NODELAY   = 9,
         ENET_SOCKOPT_IPV6_V6ONLY = 10,
         ENET_SOCKOPT_TTL       = 11,
+        ENET_SOCKOPT_REUSEPORT = 12, /**< only where the platform has SO_REUSEPORT, fails otherwise */
     } ENetSocketOption;
 
     typedef enum _ENetSocketShutdown {
@@ -686,6 +711,8 @@ extern "C" {
      */
     typedef struct _ENetPeer {
         ENetListNode      dispatchList;
+        ENetListNode      activeList;        /**< link in host->activePeers while the peer is not disconnected */
+        ENetListNode      freeList;          /**< link in host->freePeers while the peer is disconnected */
         struct _ENetHost *host;
         enet_uint16       outgoingPeerID;
         enet_uint16       incomingPeerID;
@@ -801,6 +828,8 @@ extern "C" {
         size_t                channelLimit; /**< maximum number of channels allowed for connected peers */
         enet_uint32           serviceTime;
         ENetList              dispatchQueue;
+        ENetList              activePeers;  /**< peers that are not disconnected, walked by the service loop */
+        ENetList              freePeers;    /**< disconnected peers, in the order they were freed, taken by new connections */
         enet_uint32           totalQueued;
         size_t                packetSize;
         enet_uint16           headerFlags;
@@ -824,6 +853,8 @@ extern "C" {
         size_t                duplicatePeers;     /**< optional number of allowed peers from duplicate IPs, defaults to ENET_PROTOCOL_MAXIMUM_PEER_ID */
         size_t                maximumPacketSize;  /**< the maximum allowable packet size that may be sent or received on a peer */
         size_t                maximumWaitingData; /**< the maximum aggregate amount of buffer space a peer may use waiting for packets to be delivered */
+        struct _ENetSocketBatch * socketBatch;    /**< recvmmsg/sendmmsg buffers, NULL unless enabled with enet_host_socket_batch */
+        struct _ENetSocketUring * socketUring;    /**< io_uring rings and buffers, NULL unless enabled with enet_host_socket_uring */
     } ENetHost;
 
     /**
@@ -1024,6 +1055,10 @@ extern "C" {
     ENET_API void       enet_host_compress(ENetHost *, const ENetCompressor *);
     ENET_API void       enet_host_channel_limit(ENetHost *, size_t);
     ENET_API void       enet_host_bandwidth_limit(ENetHost *, enet_uint32, enet_uint32);
+    ENET_API int        enet_host_socket_batch(ENetHost *, size_t);
+    ENET_API int        enet_host_socket_uring(ENetHost *, size_t);
+    ENET_API ENetSocket enet_host_wait_socket(ENetHost *);
+    ENET_API int        enet_host_socket_pending(ENetHost *);
     extern   void       enet_host_bandwidth_throttle(ENetHost *);
     extern  enet_uint64 enet_host_random_seed(void);
     extern  enet_uint32 enet_host_random(ENetHost *);
@@ -1583,6 +1618,35 @@ extern "C" {
         return commandSizes[commandNumber & ENET_PROTOCOL_COMMAND_MASK];
     }
 
+    static ENetPeer * enet_peer_from_active_node(ENetListIterator node) {
+        return (ENetPeer *) ((enet_uint8 *) node - offsetof(ENetPeer, activeList));
+    }
+
+    static ENetPeer * enet_peer_from_free_node(ENetListIterator node) {
+        return (ENetPeer *) ((enet_uint8 *) node - offsetof(ENetPeer, freeList));
+    }
+
+    static void enet_peer_activate(ENetPeer *peer) {
+        if (peer->freeList.next != NULL) {
+            enet_list_remove(&peer->freeList);
+            peer->freeList.next = peer->freeList.previous = NULL;
+        }
+        if (peer->activeList.next == NULL) {
+            enet_list_insert(enet_list_end(&peer->host->activePeers), &peer->activeList);
+        }
+    }
+
+    static void enet_peer_deactivate(ENetPeer *peer) {
+        if (peer->activeList.next != NULL) {
+            enet_list_remove(&peer->activeList);
+            peer->activeList.next = peer->activeList.previous = NULL;
+        }
+        // Reused last, so a freed slot rests as long as possible before the next connection takes it
+        if (peer->freeList.next == NULL) {
+            enet_list_insert(enet_list_end(&peer->host->freePeers), &peer->freeList);
+        }
+    }
+
     static void enet_protocol_change_state(ENetHost *host, ENetPeer *peer, ENetPeerState state) {
         ENET_UNUSED(host)
 
@@ -1845,6 +1909,7 @@ extern "C" {
         ENetChannel *channel;
         size_t channelCount, duplicatePeers = 0;
         ENetPeer *currentPeer, *peer = NULL;
+        ENetListIterator node;
         ENetProtocol verifyCommand;
 
         channelCount = ENET_NET_TO_HOST_32(command->connect.channelCount);
@@ -1853,12 +1918,11 @@ extern "C" {
             return NULL;
         }
 
-        for (currentPeer = host->peers; currentPeer < &host->peers[host->peerCount]; ++currentPeer) {
-            if (currentPeer->state == ENET_PEER_STATE_DISCONNECTED) {
-                if (peer == NULL) {
-                    peer = currentPeer;
-                }
-            } else if (currentPeer->state != ENET_PEER_STATE_CONNECTING && in6_equal(currentPeer->address.host, host->receivedAddress.host)) {
+        // Only peers that are not disconnected can be duplicates, so walk the active list instead of every slot
+        for (node = enet_list_begin(&host->activePeers); node != enet_list_end(&host->activePeers); node = enet_list_next(node)) {
+            currentPeer = enet_peer_from_active_node(node);
+
+            if (currentPeer->state != ENET_PEER_STATE_CONNECTING && in6_equal(currentPeer->address.host, host->receivedAddress.host)) {
                 if (currentPeer->address.port == host->receivedAddress.port && currentPeer->connectID == command->connect.connectID) {
                     return NULL;
                 }
@@ -1867,6 +1931,10 @@ extern "C" {
             }
         }
 
+        if (duplicatePeers < host->duplicatePeers && !enet_list_empty(&host->freePeers)) {
+            peer = enet_peer_from_free_node(enet_list_begin(&host->freePeers));
+        }
+
         if (peer == NULL || duplicatePeers >= host->duplicatePeers) {
             return NULL;
         }
@@ -1880,6 +1948,7 @@ extern "C" {
         }
         peer->channelCount               = channelCount;
         peer->state                      = ENET_PEER_STATE_ACKNOWLEDGING_CONNECT;
+        enet_peer_activate(peer);
         peer->connectID                  = command->connect.connectID;
         peer->address                    = host->receivedAddress;
         peer->mtu                        = host->mtu;
@@ -2798,18 +2867,564 @@ extern "C" {
         return 0;
     } /* enet_protocol_handle_incoming_commands */
 
+#ifdef ENET_SOCKET_BATCH
+    /** Datagrams received by one recvmmsg and staged for one sendmmsg */
+    typedef struct _ENetSocketBatch {
+        size_t                capacity;
+        size_t                receivedCount;  /**< datagrams returned by the last recvmmsg */
+        size_t                receivedCursor; /**< next of them handed to the protocol */
+        size_t                sendCount;      /**< datagrams staged for the next sendmmsg */
+        struct mmsghdr *      receiveMessages;
+        struct iovec *        receiveVectors;
+        struct sockaddr_in6 * receiveAddresses;
+        enet_uint8 *          receiveData;
+        struct mmsghdr *      sendMessages;
+        struct iovec *        sendVectors;
+        struct sockaddr_in6 * sendAddresses;
+        enet_uint8 *          sendData;
+    } ENetSocketBatch;
+
+    /** Returns the next received datagram, calling recvmmsg once the previous batch is used up.
+     *  Same return values as enet_socket_receive, the data is left in *data
+     */
+    static int enet_socket_batch_receive(ENetHost *host, enet_uint8 **data) {
+        ENetSocketBatch *batch = host->socketBatch;
+        struct mmsghdr *message;
+        struct sockaddr_in6 *sin;
+        size_t index;
+
+        if (batch->receivedCursor == batch->receivedCount) {
+            int count;
+
+            for (index = 0; index < batch->receivedCount; ++index) {
+                batch->receiveMessages[index].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+                batch->receiveMessages[index].msg_hdr.msg_flags   = 0;
+            }
+            for (index = 0; index < batch->capacity; ++index) {
+                batch->receiveVectors[index].iov_len = host->mtu;
+            }
+
+            batch->receivedCount = batch->receivedCursor = 0;
+            count = recvmmsg(host->socket, batch->receiveMessages, (unsigned int) batch->capacity, MSG_DONTWAIT, NULL);
+
+            if (count < 0) {
+                return errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+            }
+            if (count == 0) {
+                return 0;
+            }
+
+            batch->receivedCount = (size_t) count;
+        }
+
+        index   = batch->receivedCursor++;
+        message = &batch->receiveMessages[index];
+
+        if (message->msg_hdr.msg_flags & MSG_TRUNC) {
+            return -2;
+        }
+
+        sin = &batch->receiveAddresses[index];
+        host->receivedAddress.host          = sin->sin6_addr;
+        host->receivedAddress.port          = ENET_NET_TO_HOST_16(sin->sin6_port);
+        host->receivedAddress.sin6_scope_id = sin->sin6_scope_id;
+
+        *data = (enet_uint8 *) batch->receiveVectors[index].iov_base;
+        return (int) message->msg_len;
+    }
+
+    /** Sends every staged datagram with sendmmsg.
+     *  Like enet_socket_send, a datagram the socket has no room for is dropped
+     */
+    static int enet_socket_batch_flush(ENetHost *host) {
+        ENetSocketBatch *batch = host->socketBatch;
+        size_t sent = 0;
+        int result  = 0;
+
+        if (batch == NULL) {
+            return 0;
+        }
+
+        while (sent < batch->sendCount) {
+            int count = sendmmsg(host->socket, &batch->sendMessages[sent], (unsigned int) (batch->sendCount - sent), MSG_NOSIGNAL);
+
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EWOULDBLOCK && errno != EMSGSIZE) {
+                    result = -1;
+                }
+                count = 1; // Skip the datagram that failed
+            }
+
+            sent += (size_t) count;
+        }
+
+        batch->sendCount = 0;
+        return result;
+    }
+
+    /** Copies a datagram into the next staging slot, flushing first if they are all used.
+     *  Returns the number of bytes staged
+     */
+    static int enet_socket_batch_send(ENetHost *host, const ENetAddress *address, const ENetBuffer *buffers, size_t bufferCount) {
+        ENetSocketBatch *batch = host->socketBatch;
+        struct sockaddr_in6 *sin;
+        enet_uint8 *data;
+        size_t length = 0, index, i;
+
+        for (index = 0; index < bufferCount; ++index) {
+            length += buffers[index].dataLength;
+        }
+
+        if (length > ENET_PROTOCOL_MAXIMUM_MTU) {
+            // Does not fit a slot, keep the order and send it on its own
+            if (enet_socket_batch_flush(host) < 0) {
+                return -1;
+            }
+            return enet_socket_send(host->socket, address, buffers, bufferCount);
+        }
+
+        if (batch->sendCount == batch->capacity && enet_socket_batch_flush(host) < 0) {
+            return -1;
+        }
+
+        index = batch->sendCount++;
+        data  = (enet_uint8 *) batch->sendVectors[index].iov_base;
+
+        for (i = 0; i < bufferCount; ++i) {
+            memcpy(data, buffers[i].data, buffers[i].dataLength);
+            data += buffers[i].dataLength;
+        }
+        batch->sendVectors[index].iov_len = length;
+
+        sin = &batch->sendAddresses[index];
+        memset(sin, 0, sizeof(struct sockaddr_in6));
+        sin->sin6_family   = AF_INET6;
+        sin->sin6_port     = ENET_HOST_TO_NET_16(address->port);
+        sin->sin6_addr     = address->host;
+        sin->sin6_scope_id = address->sin6_scope_id;
+
+        return (int) length;
+    }
+
+    static void enet_socket_batch_destroy(ENetHost *host) {
+        ENetSocketBatch *batch = host->socketBatch;
+
+        if (batch == NULL) {
+            return;
+        }
+
+        enet_socket_batch_flush(host);
+        host->socketBatch = NULL;
+
+        enet_free(batch->receiveMessages);
+        enet_free(batch->receiveVectors);
+        enet_free(batch->receiveAddresses);
+        enet_free(batch->receiveData);
+        enet_free(batch->sendMessages);
+        enet_free(batch->sendVectors);
+        enet_free(batch->sendAddresses);
+        enet_free(batch->sendData);
+        enet_free(batch);
+    }
+#else
+    static int enet_socket_batch_flush(ENetHost *host) {
+        ENET_UNUSED(host)
+        return 0;
+    }
+#endif
+
+#ifdef ENET_SOCKET_URING
+    #define ENET_SOCKET_URING_RECEIVE_TAG 0x100000000ULL /**< user_data of the multishot recvmsg */
+    #define ENET_SOCKET_URING_SEND_TAG    0x200000000ULL /**< user_data of a sendmsg, ORed with its slot */
+
+    /** io_uring submission and completion rings, provided receive buffers and send staging slots */
+    typedef struct _ENetSocketUring {
+        int                        ringFd;
+        size_t                     entries;           /**< provided receive buffers, also the number of send slots */
+        void *                     ringMemory;        /**< SQ and CQ rings, mapped together */
+        size_t                     ringMemorySize;
+        struct io_uring_sqe *      sqes;
+        size_t                     sqesSize;
+        enet_uint32 *              sqHead;
+        enet_uint32 *              sqTail;
+        enet_uint32                sqMask;
+        enet_uint32                sqEntries;
+        enet_uint32 *              sqArray;
+        enet_uint32                sqPending;         /**< SQEs queued since the last io_uring_enter */
+        enet_uint32 *              cqHead;
+        enet_uint32 *              cqTail;
+        enet_uint32                cqMask;
+        struct io_uring_cqe *      cqes;
+        struct io_uring_buf_ring * bufferRing;
+        size_t                     bufferRingSize;
+        enet_uint8 *               receiveData;
+        size_t                     receiveBufferSize; /**< recvmsg header, source address and one MTU of payload */
+        int                        heldBuffer;        /**< buffer the protocol is reading, given back on the next receive, -1 if none */
+        int                        receiveArmed;      /**< the multishot recvmsg is still producing completions */
+        struct msghdr              receiveHeader;     /**< only tells multishot recvmsg how much room to leave for the address */
+        struct msghdr *            sendMessages;
+        struct iovec *             sendVectors;
+        struct sockaddr_in6 *      sendAddresses;
+        enet_uint8 *               sendData;
+        enet_uint32 *              freeSlots;
+        size_t                     freeSlotCount;
+        struct io_uring_cqe *      receiveCompletions;     /**< receive CQEs set aside by enet_socket_uring_reap_sends, in order */
+        size_t                     receiveCompletionHead;  /**< next one enet_socket_uring_receive takes */
+        size_t                     receiveCompletionCount;
+    } ENetSocketUring;
+
+    static int enet_socket_uring_enter(ENetSocketUring *uring, enet_uint32 toSubmit, enet_uint32 minComplete, enet_uint32 flags) {
+        return (int) syscall(__NR_io_uring_enter, uring->ringFd, toSubmit, minComplete, flags, NULL, 0);
+    }
+
+    /** Submits every queued SQE. Leaves them queued when the kernel pushes back with EAGAIN or EBUSY */
+    static int enet_socket_uring_submit(ENetSocketUring *uring) {
+        while (uring->sqPending > 0) {
+            int submitted = enet_socket_uring_enter(uring, uring->sqPending, 0, 0);
+
+            if (submitted < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EBUSY ? 0 : -1;
+            }
+
+            uring->sqPending -= (enet_uint32) submitted;
+        }
+
+        return 0;
+    }
+
+    /** Returns a zeroed SQE, already counted in the SQ tail, or NULL when the SQ is full.
+     *  Without SQPOLL the kernel only reads SQEs during io_uring_enter, so it can be filled in afterwards
+     */
+    static struct io_uring_sqe *enet_socket_uring_get_sqe(ENetSocketUring *uring) {
+        enet_uint32 tail = *uring->sqTail;
+        struct io_uring_sqe *sqe;
+
+        if (tail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE) >= uring->sqEntries) {
+            if (enet_socket_uring_submit(uring) < 0 || tail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE) >= uring->sqEntries) {
+                return NULL;
+            }
+        }
+
+        sqe = &uring->sqes[tail & uring->sqMask];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        uring->sqArray[tail & uring->sqMask] = tail & uring->sqMask;
+
+        __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+        uring->sqPending++;
+        return sqe;
+    }
+
+    /** Hands a receive buffer back to the kernel through the provided buffer ring */
+    static void enet_socket_uring_recycle(ENetSocketUring *uring, enet_uint16 bufferId) {
+        // Indexed by hand, in C++ the header's flexible array member doesn't start at offset 0.
+        // The ring tail overlays resv of the first entry
+        struct io_uring_buf *entries = (struct io_uring_buf *) (void *) uring->bufferRing;
+        enet_uint16 tail = entries[0].resv;
+        struct io_uring_buf *buffer = &entries[tail & (uring->entries - 1)];
+
+        buffer->addr = (enet_uint64) (uintptr_t) (uring->receiveData + bufferId * uring->receiveBufferSize);
+        buffer->len  = (enet_uint32) uring->receiveBufferSize;
+        buffer->bid  = bufferId;
+
+        __atomic_store_n(&entries[0].resv, (enet_uint16) (tail + 1), __ATOMIC_RELEASE);
+    }
+
+    /** Queues the multishot recvmsg. It keeps completing into provided buffers until the kernel ends it */
+    static void enet_socket_uring_arm_receive(ENetHost *host) {
+        ENetSocketUring *uring = host->socketUring;
+        struct io_uring_sqe *sqe = enet_socket_uring_get_sqe(uring);
+
+        if (sqe == NULL) {
+            return; // Retried on the next receive
+        }
+
+        sqe->opcode    = IORING_OP_RECVMSG;
+        sqe->fd        = host->socket;
+        sqe->addr      = (enet_uint64) (uintptr_t) &uring->receiveHeader;
+        sqe->len       = 1;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = ENET_SOCKET_URING_RECEIVE_TAG;
+
+        uring->receiveArmed = 1;
+    }
+
+    /** Consumes every completion in the CQ, freeing the slots of sends.
+     *  Receive completions are set aside in order for enet_socket_uring_receive
+     */
+    static void enet_socket_uring_reap_sends(ENetSocketUring *uring) {
+        enet_uint32 head = *uring->cqHead;
+
+        while (head != __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+
+            if (cqe->user_data & ENET_SOCKET_URING_SEND_TAG) {
+                uring->freeSlots[uring->freeSlotCount++] = (enet_uint32) (cqe->user_data & 0xFFFFFFFF);
+            } else if (uring->receiveCompletionCount < uring->entries + 1) {
+                uring->receiveCompletions[uring->receiveCompletionCount++] = *cqe;
+            } else {
+                // Can't happen with one buffer per completion, but stop rather than lose one
+                break;
+            }
+
+            __atomic_store_n(uring->cqHead, ++head, __ATOMIC_RELEASE);
+        }
+    }
+
+    static void enet_socket_uring_destroy(ENetHost *);
+
+    /** Returns the next datagram completed by the multishot recvmsg.
+     *  Same return values as enet_socket_receive, the data is left in *data until the next call
+     */
+    static int enet_socket_uring_receive(ENetHost *host, enet_uint8 **data) {
+        ENetSocketUring *uring = host->socketUring;
+
+        if (uring->heldBuffer >= 0) {
+            enet_socket_uring_recycle(uring, (enet_uint16) uring->heldBuffer);
+            uring->heldBuffer = -1;
+        }
+
+        // Armed by the servicing thread, completion work runs on the thread that submitted
+        if (!uring->receiveArmed) {
+            enet_socket_uring_arm_receive(host);
+        }
+
+        for (;;) {
+            enet_uint32 head = *uring->cqHead;
+            struct io_uring_cqe *cqe;
+            struct io_uring_recvmsg_out *out;
+            struct sockaddr_in6 *sin;
+            enet_uint8 *buffer;
+            enet_uint64 userData;
+            enet_uint32 flags;
+            int result;
+
+            if (uring->receiveCompletionHead < uring->receiveCompletionCount) {
+                // Set aside while reaping sends, they came before anything still in the CQ
+                cqe      = &uring->receiveCompletions[uring->receiveCompletionHead++];
+                userData = cqe->user_data;
+                result   = cqe->res;
+                flags    = cqe->flags;
+                if (uring->receiveCompletionHead == uring->receiveCompletionCount) {
+                    uring->receiveCompletionHead  = 0;
+                    uring->receiveCompletionCount = 0;
+                }
+            } else if (head == __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE)) {
+                // Nothing left, send the re-arm if one is waiting
+                return enet_socket_uring_submit(uring) < 0 ? -1 : 0;
+            } else {
+                cqe      = &uring->cqes[head & uring->cqMask];
+                userData = cqe->user_data;
+                result   = cqe->res;
+                flags    = cqe->flags;
+                __atomic_store_n(uring->cqHead, head + 1, __ATOMIC_RELEASE);
+            }
+
+            if (userData & ENET_SOCKET_URING_SEND_TAG) {
+                uring->freeSlots[uring->freeSlotCount++] = (enet_uint32) (userData & 0xFFFFFFFF);
+                continue;
+            }
+
+            if (!(flags & IORING_CQE_F_MORE)) {
+                // The kernel ended the multishot, usually because it ran out of buffers
+                uring->receiveArmed = 0;
+                if (result == -EINVAL) {
+                    // No multishot recvmsg in this kernel, go back to the socket path
+                    enet_socket_uring_destroy(host);
+                    return 0;
+                }
+                enet_socket_uring_arm_receive(host);
+            }
+
+            if (result < 0) {
+                if (result == -ENOBUFS || result == -EINTR || result == -EAGAIN) {
+                    continue;
+                }
+                return -1;
+            }
+
+            if (!(flags & IORING_CQE_F_BUFFER)) {
+                continue;
+            }
+
+            uring->heldBuffer = (int) (flags >> IORING_CQE_BUFFER_SHIFT);
+            buffer = uring->receiveData + uring->heldBuffer * uring->receiveBufferSize;
+            out    = (struct io_uring_recvmsg_out *) buffer;
+
+            if (out->flags & MSG_TRUNC) {
+                return -2;
+            }
+
+            sin = (struct sockaddr_in6 *) (buffer + sizeof(struct io_uring_recvmsg_out));
+            host->receivedAddress.host          = sin->sin6_addr;
+            host->receivedAddress.port          = ENET_NET_TO_HOST_16(sin->sin6_port);
+            host->receivedAddress.sin6_scope_id = sin->sin6_scope_id;
+
+            *data = buffer + sizeof(struct io_uring_recvmsg_out) + uring->receiveHeader.msg_namelen + uring->receiveHeader.msg_controllen;
+            return (int) out->payloadlen;
+        }
+    }
+
+    /** Copies a datagram into a free send slot and queues a sendmsg for it, submitted by enet_host_socket_flush.
+     *  Sends right away when no slot or SQE is free. Returns the number of bytes queued or sent
+     */
+    static int enet_socket_uring_send(ENetHost *host, const ENetAddress *address, const ENetBuffer *buffers, size_t bufferCount) {
+        ENetSocketUring *uring = host->socketUring;
+        struct io_uring_sqe *sqe;
+        struct sockaddr_in6 *sin;
+        enet_uint8 *data;
+        enet_uint32 slot;
+        size_t length = 0, i;
+
+        for (i = 0; i < bufferCount; ++i) {
+            length += buffers[i].dataLength;
+        }
+
+        if (uring->freeSlotCount == 0) {
+            enet_socket_uring_reap_sends(uring);
+        }
+
+        if (length > ENET_PROTOCOL_MAXIMUM_MTU || uring->freeSlotCount == 0 || (sqe = enet_socket_uring_get_sqe(uring)) == NULL) {
+            return enet_socket_send(host->socket, address, buffers, bufferCount);
+        }
+
+        slot = uring->freeSlots[--uring->freeSlotCount];
+        data = uring->sendData + slot * ENET_PROTOCOL_MAXIMUM_MTU;
+
+        for (i = 0; i < bufferCount; ++i) {
+            memcpy(data, buffers[i].data, buffers[i].dataLength);
+            data += buffers[i].dataLength;
+        }
+        uring->sendVectors[slot].iov_len = length;
+
+        sin = &uring->sendAddresses[slot];
+        memset(sin, 0, sizeof(struct sockaddr_in6));
+        sin->sin6_family   = AF_INET6;
+        sin->sin6_port     = ENET_HOST_TO_NET_16(address->port);
+        sin->sin6_addr     = address->host;
+        sin->sin6_scope_id = address->sin6_scope_id;
+
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->fd        = host->socket;
+        sqe->addr      = (enet_uint64) (uintptr_t) &uring->sendMessages[slot];
+        sqe->len       = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = ENET_SOCKET_URING_SEND_TAG | slot;
+
+        return (int) length;
+    }
+
+    static void enet_socket_uring_destroy(ENetHost *host) {
+        ENetSocketUring *uring = host->socketUring;
+
+        if (uring == NULL) {
+            return;
+        }
+
+        host->socketUring = NULL;
+
+        if (uring->ringFd >= 0 && uring->sqes != NULL && uring->ringMemory != NULL && uring->freeSlots != NULL) {
+            // Let queued sends go out and wait for them, the kernel reads their slots until they complete
+            enet_socket_uring_submit(uring);
+
+            while (uring->sqPending == 0 && uring->freeSlotCount < uring->entries) {
+                enet_uint32 head = *uring->cqHead;
+
+                if (head == __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE)) {
+                    if (enet_socket_uring_enter(uring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                        break;
+                    }
+                    continue;
+                }
+
+                if (uring->cqes[head & uring->cqMask].user_data & ENET_SOCKET_URING_SEND_TAG) {
+                    uring->freeSlotCount++;
+                }
+                __atomic_store_n(uring->cqHead, head + 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        if (uring->ringFd >= 0) {
+            close(uring->ringFd);
+        }
+        if (uring->ringMemory != NULL) {
+            munmap(uring->ringMemory, uring->ringMemorySize);
+        }
+        if (uring->sqes != NULL) {
+            munmap(uring->sqes, uring->sqesSize);
+        }
+        if (uring->bufferRing != NULL) {
+            munmap(uring->bufferRing, uring->bufferRingSize);
+        }
+
+        enet_free(uring->receiveData);
+        enet_free(uring->sendMessages);
+        enet_free(uring->sendVectors);
+        enet_free(uring->sendAddresses);
+        enet_free(uring->sendData);
+        enet_free(uring->freeSlots);
+        enet_free(uring->receiveCompletions);
+        enet_free(uring);
+    }
+#endif
+
+    /** Sends every datagram staged by the batching or io_uring backend */
+    static int enet_host_socket_flush(ENetHost *host) {
+#ifdef ENET_SOCKET_URING
+        if (host->socketUring != NULL) {
+            return enet_socket_uring_submit(host->socketUring);
+        }
+#endif
+        return enet_socket_batch_flush(host);
+    }
+
+    /** Sends a datagram, or stages it when batching or io_uring is enabled */
+    static int enet_host_socket_send(ENetHost *host, const ENetAddress *address, const ENetBuffer *buffers, size_t bufferCount) {
+#ifdef ENET_SOCKET_URING
+        if (host->socketUring != NULL) {
+            return enet_socket_uring_send(host, address, buffers, bufferCount);
+        }
+#endif
+#ifdef ENET_SOCKET_BATCH
+        if (host->socketBatch != NULL) {
+            return enet_socket_batch_send(host, address, buffers, bufferCount);
+        }
+#endif
+        return enet_socket_send(host->socket, address, buffers, bufferCount);
+    }
+
     static int enet_protocol_receive_incoming_commands(ENetHost *host, ENetEvent *event) {
         int packets;
 
         for (packets = 0; packets < 256; ++packets) {
             int receivedLength;
             ENetBuffer buffer;
+            enet_uint8 *receivedData = host->packetData[0];
 
-            buffer.data       = host->packetData[0];
-            // buffer.dataLength = sizeof (host->packetData[0]);
-            buffer.dataLength = host->mtu;
+#ifdef ENET_SOCKET_URING
+            if (host->socketUring != NULL) {
+                receivedLength = enet_socket_uring_receive(host, &receivedData);
+            } else
+#endif
+#ifdef ENET_SOCKET_BATCH
+            if (host->socketBatch != NULL) {
+                receivedLength = enet_socket_batch_receive(host, &receivedData);
+            } else
+#endif
+            {
+                buffer.data       = host->packetData[0];
+                // buffer.dataLength = sizeof (host->packetData[0]);
+                buffer.dataLength = host->mtu;
 
-            receivedLength    = enet_socket_receive(host->socket, &host->receivedAddress, &buffer, 1);
+                receivedLength    = enet_socket_receive(host->socket, &host->receivedAddress, &buffer, 1);
+            }
 
             if (receivedLength == -2)
                 continue;
@@ -2822,7 +3437,7 @@ extern "C" {
                 return 0;
             }
 
-            host->receivedData       = host->packetData[0];
+            host->receivedData       = receivedData;
             host->receivedDataLength = receivedLength;
 
             host->totalReceivedData += receivedLength;
@@ -3150,11 +3765,17 @@ extern "C" {
         ENetList sentUnreliableCommands;
         int sendPass = 0, continueSending = 0;
         ENetPeer *currentPeer;
+        ENetListIterator node, nextNode;
 
         enet_list_clear (&sentUnreliableCommands);
 
+        // Walk only the active peers so the cost per service scales with connections, not peerCount.
+        // The next node is saved up front because a timeout resets (and unlinks) the current peer.
         for (; sendPass <= continueSending; ++ sendPass)
-            for(currentPeer = host->peers; currentPeer < &host->peers[host->peerCount]; ++currentPeer) {
+            for (node = enet_list_begin(&host->activePeers); node != enet_list_end(&host->activePeers); node = nextNode) {
+                nextNode    = enet_list_next(node);
+                currentPeer = enet_peer_from_active_node(node);
+
                 if (currentPeer->state == ENET_PEER_STATE_DISCONNECTED || currentPeer->state == ENET_PEER_STATE_ZOMBIE || (sendPass > 0 && ! (currentPeer->flags & ENET_PEER_FLAG_CONTINUE_SENDING))) {
                     continue;
                 }
@@ -3176,6 +3797,7 @@ extern "C" {
                     enet_protocol_check_timeouts(host, currentPeer, event) == 1
                 ) {
                     if (event != NULL && event->type != ENET_EVENT_TYPE_NONE) {
+                        enet_host_socket_flush(host);
                         return 1;
                     } else {
                         goto nextPeer;
@@ -3286,13 +3908,14 @@ extern "C" {
                 }
 
                 currentPeer->lastSendTime = host->serviceTime;
-                sentLength = enet_socket_send(host->socket, &currentPeer->address, host->buffers, host->bufferCount);
+                sentLength = enet_host_socket_send(host, &currentPeer->address, host->buffers, host->bufferCount);
                 enet_protocol_remove_sent_unreliable_commands(currentPeer, &sentUnreliableCommands);
 
                 if (sentLength < 0) {
                     // The local 'headerData' array (to which 'data' is assigned) goes out
                     // of scope on return from this function, so ensure we no longer point to it.
                     host->buffers[0].data = NULL;
+                    enet_host_socket_flush(host);
                     return -1;
                 }
 
@@ -3308,7 +3931,8 @@ extern "C" {
         // of scope on return from this function, so ensure we no longer point to it.
         host->buffers[0].data = NULL;
 
-        return 0;
+        // Staged datagrams go out together, one syscall per batch or io_uring submit instead of per peer
+        return enet_host_socket_flush(host) < 0 ? -1 : 0;
     } /* enet_protocol_send_outgoing_commands */
 
     /** Sends any queued packets on the host specified to its designated peers.
@@ -3459,8 +4083,14 @@ extern "C" {
                     return 0;
                 }
 
+                // Datagrams already taken off the socket don't make it readable, don't sleep on them
+                if (enet_host_socket_pending(host)) {
+                    waitCondition = ENET_SOCKET_WAIT_RECEIVE;
+                    break;
+                }
+
                 waitCondition = ENET_SOCKET_WAIT_RECEIVE | ENET_SOCKET_WAIT_INTERRUPT;
-                if (enet_socket_wait(host->socket, &waitCondition, ENET_TIME_DIFFERENCE(timeout, host->serviceTime)) != 0) {
+                if (enet_socket_wait(enet_host_wait_socket(host), &waitCondition, ENET_TIME_DIFFERENCE(timeout, host->serviceTime)) != 0) {
                     return -1;
                 }
             } while (waitCondition & ENET_SOCKET_WAIT_INTERRUPT);
@@ -3906,6 +4536,7 @@ extern "C" {
         // peer->connectID                     = 0;
         peer->outgoingPeerID                = ENET_PROTOCOL_MAXIMUM_PEER_ID;
         peer->state                         = ENET_PEER_STATE_DISCONNECTED;
+        enet_peer_deactivate(peer);
         peer->incomingBandwidth             = 0;
         peer->outgoingBandwidth             = 0;
         peer->incomingBandwidthThrottleEpoch = 0;
@@ -4616,9 +5247,13 @@ extern "C" {
         host->intercept                     = NULL;
 
         enet_list_clear(&host->dispatchQueue);
+        enet_list_clear(&host->activePeers);
+        enet_list_clear(&host->freePeers);
 
         for (currentPeer = host->peers; currentPeer < &host->peers[host->peerCount]; ++currentPeer) {
             currentPeer->host = host;
+            currentPeer->activeList.next = currentPeer->activeList.previous = NULL;
+            currentPeer->freeList.next = currentPeer->freeList.previous = NULL;
             currentPeer->incomingPeerID    = currentPeer - host->peers;
             currentPeer->outgoingSessionID = currentPeer->incomingSessionID = 0xFF;
             currentPeer->data = NULL;
@@ -4645,6 +5280,12 @@ extern "C" {
             return;
         }
 
+#ifdef ENET_SOCKET_URING
+        enet_socket_uring_destroy(host);
+#endif
+#ifdef ENET_SOCKET_BATCH
+        enet_socket_batch_destroy(host);
+#endif
         enet_socket_destroy(host->socket);
 
         for (currentPeer = host->peers; currentPeer < &host->peers[host->peerCount]; ++currentPeer) {
@@ -4687,15 +5328,10 @@ extern "C" {
             channelCount = ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT;
         }
 
-        for (currentPeer = host->peers; currentPeer < &host->peers[host->peerCount]; ++currentPeer) {
-            if (currentPeer->state == ENET_PEER_STATE_DISCONNECTED) {
-                break;
-            }
-        }
-
-        if (currentPeer >= &host->peers[host->peerCount]) {
+        if (enet_list_empty(&host->freePeers)) {
             return NULL;
         }
+        currentPeer = enet_peer_from_free_node(enet_list_begin(&host->freePeers));
 
         currentPeer->channels = (ENetChannel *) enet_malloc(channelCount * sizeof(ENetChannel));
         if (currentPeer->channels == NULL) {
@@ -4704,6 +5340,7 @@ extern "C" {
 
         currentPeer->channelCount = channelCount;
         currentPeer->state        = ENET_PEER_STATE_CONNECTING;
+        enet_peer_activate(currentPeer);
         currentPeer->address      = *address;
         currentPeer->connectID    = enet_host_random(host);
         currentPeer->mtu          = host->mtu;
@@ -4761,8 +5398,11 @@ extern "C" {
      */
     void enet_host_broadcast(ENetHost *host, enet_uint8 channelID, ENetPacket *packet) {
         ENetPeer *currentPeer;
+        ENetListIterator node;
+
+        for (node = enet_list_begin(&host->activePeers); node != enet_list_end(&host->activePeers); node = enet_list_next(node)) {
+            currentPeer = enet_peer_from_active_node(node);
 
-        for (currentPeer = host->peers; currentPeer < &host->peers[host->peerCount]; ++currentPeer) {
             if (currentPeer->state != ENET_PEER_STATE_CONNECTED) {
                 continue;
             }
@@ -4857,6 +5497,247 @@ extern "C" {
         host->recalculateBandwidthLimits = 1;
     }
 
+    /** Receives and sends datagrams in batches with recvmmsg/sendmmsg, one syscall for up to batchSize of them.
+     *  @param host host to configure
+     *  @param batchSize datagrams per syscall, 0 goes back to one syscall per datagram
+     *  @retval 0 on success
+     *  @retval -1 on allocation failure, or where recvmmsg/sendmmsg are unavailable (only Linux has them)
+     */
+    int enet_host_socket_batch(ENetHost *host, size_t batchSize) {
+#ifdef ENET_SOCKET_BATCH
+        ENetSocketBatch *batch;
+        size_t i;
+
+        enet_socket_batch_destroy(host);
+
+        if (batchSize == 0) {
+            return 0;
+        }
+
+        batch = (ENetSocketBatch *) enet_malloc(sizeof(ENetSocketBatch));
+        if (batch == NULL) {
+            return -1;
+        }
+        memset(batch, 0, sizeof(ENetSocketBatch));
+        host->socketBatch = batch;
+
+        batch->capacity         = batchSize;
+        batch->receiveMessages  = (struct mmsghdr *) enet_malloc(batchSize * sizeof(struct mmsghdr));
+        batch->receiveVectors   = (struct iovec *) enet_malloc(batchSize * sizeof(struct iovec));
+        batch->receiveAddresses = (struct sockaddr_in6 *) enet_malloc(batchSize * sizeof(struct sockaddr_in6));
+        batch->receiveData      = (enet_uint8 *) enet_malloc(batchSize * ENET_PROTOCOL_MAXIMUM_MTU);
+        batch->sendMessages     = (struct mmsghdr *) enet_malloc(batchSize * sizeof(struct mmsghdr));
+        batch->sendVectors      = (struct iovec *) enet_malloc(batchSize * sizeof(struct iovec));
+        batch->sendAddresses    = (struct sockaddr_in6 *) enet_malloc(batchSize * sizeof(struct sockaddr_in6));
+        batch->sendData         = (enet_uint8 *) enet_malloc(batchSize * ENET_PROTOCOL_MAXIMUM_MTU);
+
+        if (batch->receiveMessages == NULL || batch->receiveVectors == NULL || batch->receiveAddresses == NULL || batch->receiveData == NULL ||
+            batch->sendMessages == NULL || batch->sendVectors == NULL || batch->sendAddresses == NULL || batch->sendData == NULL
+        ) {
+            enet_socket_batch_destroy(host);
+            return -1;
+        }
+
+        memset(batch->receiveMessages, 0, batchSize * sizeof(struct mmsghdr));
+        memset(batch->sendMessages, 0, batchSize * sizeof(struct mmsghdr));
+
+        for (i = 0; i < batchSize; ++i) {
+            batch->receiveVectors[i].iov_base = batch->receiveData + i * ENET_PROTOCOL_MAXIMUM_MTU;
+            batch->receiveVectors[i].iov_len  = host->mtu;
+            batch->receiveMessages[i].msg_hdr.msg_iov     = &batch->receiveVectors[i];
+            batch->receiveMessages[i].msg_hdr.msg_iovlen  = 1;
+            batch->receiveMessages[i].msg_hdr.msg_name    = &batch->receiveAddresses[i];
+            batch->receiveMessages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+
+            batch->sendVectors[i].iov_base = batch->sendData + i * ENET_PROTOCOL_MAXIMUM_MTU;
+            batch->sendMessages[i].msg_hdr.msg_iov     = &batch->sendVectors[i];
+            batch->sendMessages[i].msg_hdr.msg_iovlen  = 1;
+            batch->sendMessages[i].msg_hdr.msg_name    = &batch->sendAddresses[i];
+            batch->sendMessages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+        }
+
+        return 0;
+#else
+        ENET_UNUSED(host)
+        ENET_UNUSED(batchSize)
+        return -1;
+#endif
+    }
+
+    /** Moves the host socket onto io_uring: a multishot recvmsg fills provided buffers,
+     *  and the datagrams of one service pass go out in a single io_uring_enter.
+     *  Takes precedence over enet_host_socket_batch while enabled
+     *  @param host host to configure
+     *  @param entries receive buffers and send slots, rounded up to a power of two. 0 goes back to the socket path
+     *  @retval 0 on success
+     *  @retval -1 where io_uring or provided buffer rings are unavailable (Linux 5.19 and later have them)
+     *  @remarks kernels without multishot recvmsg (before 6.0) fall back to the socket path on the first receive.
+     *  While enabled, wait on enet_host_wait_socket instead of the host socket
+     */
+    int enet_host_socket_uring(ENetHost *host, size_t entries) {
+#ifdef ENET_SOCKET_URING
+        ENetSocketUring *uring;
+        struct io_uring_params params;
+        struct io_uring_buf_reg registration;
+        size_t sqSize, cqSize, i;
+        void *memory;
+
+        enet_socket_uring_destroy(host);
+
+        if (entries == 0) {
+            return 0;
+        }
+
+        // The buffer ring needs a power of two, and buffer ids are 16 bits
+        if (entries > 32768) {
+            entries = 32768;
+        }
+        for (i = 1; i < entries; i <<= 1) {}
+        entries = i;
+
+        uring = (ENetSocketUring *) enet_malloc(sizeof(ENetSocketUring));
+        if (uring == NULL) {
+            return -1;
+        }
+        memset(uring, 0, sizeof(ENetSocketUring));
+        uring->ringFd     = -1;
+        uring->heldBuffer = -1;
+        uring->entries    = entries;
+        host->socketUring = uring;
+
+        // Room for every send in flight plus the multishot, and for a completion per buffer and per send
+        memset(&params, 0, sizeof(params));
+        params.flags      = IORING_SETUP_CQSIZE;
+        params.cq_entries = (enet_uint32) (entries * 4);
+
+        uring->ringFd = (int) syscall(__NR_io_uring_setup, (unsigned int) (entries * 2), &params);
+        if (uring->ringFd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            enet_socket_uring_destroy(host);
+            return -1;
+        }
+
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(enet_uint32);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        uring->ringMemorySize = sqSize > cqSize ? sqSize : cqSize;
+
+        memory = mmap(NULL, uring->ringMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_SQ_RING);
+        if (memory == MAP_FAILED) {
+            enet_socket_uring_destroy(host);
+            return -1;
+        }
+        uring->ringMemory = memory;
+
+        uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        memory = mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_SQES);
+        if (memory == MAP_FAILED) {
+            enet_socket_uring_destroy(host);
+            return -1;
+        }
+        uring->sqes = (struct io_uring_sqe *) memory;
+
+        uring->sqHead    = (enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.sq_off.head);
+        uring->sqTail    = (enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.sq_off.tail);
+        uring->sqMask    = *(enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.sq_off.ring_mask);
+        uring->sqArray   = (enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.sq_off.array);
+        uring->sqEntries = params.sq_entries;
+        uring->cqHead    = (enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.cq_off.head);
+        uring->cqTail    = (enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.cq_off.tail);
+        uring->cqMask    = *(enet_uint32 *) ((enet_uint8 *) uring->ringMemory + params.cq_off.ring_mask);
+        uring->cqes      = (struct io_uring_cqe *) ((enet_uint8 *) uring->ringMemory + params.cq_off.cqes);
+
+        // The buffer ring has to be page aligned
+        uring->bufferRingSize = entries * sizeof(struct io_uring_buf);
+        memory = mmap(NULL, uring->bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            enet_socket_uring_destroy(host);
+            return -1;
+        }
+        uring->bufferRing = (struct io_uring_buf_ring *) memory;
+
+        memset(&registration, 0, sizeof(registration));
+        registration.ring_addr    = (enet_uint64) (uintptr_t) uring->bufferRing;
+        registration.ring_entries = (enet_uint32) entries;
+        registration.bgid         = 0;
+
+        if (syscall(__NR_io_uring_register, uring->ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+            enet_socket_uring_destroy(host);
+            return -1;
+        }
+
+        uring->receiveBufferSize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in6) + ENET_PROTOCOL_MAXIMUM_MTU;
+        uring->receiveData   = (enet_uint8 *) enet_malloc(entries * uring->receiveBufferSize);
+        uring->sendMessages  = (struct msghdr *) enet_malloc(entries * sizeof(struct msghdr));
+        uring->sendVectors   = (struct iovec *) enet_malloc(entries * sizeof(struct iovec));
+        uring->sendAddresses = (struct sockaddr_in6 *) enet_malloc(entries * sizeof(struct sockaddr_in6));
+        uring->sendData      = (enet_uint8 *) enet_malloc(entries * ENET_PROTOCOL_MAXIMUM_MTU);
+        uring->freeSlots     = (enet_uint32 *) enet_malloc(entries * sizeof(enet_uint32));
+        // One completion per provided buffer, plus the one ending the multishot
+        uring->receiveCompletions = (struct io_uring_cqe *) enet_malloc((entries + 1) * sizeof(struct io_uring_cqe));
+
+        if (uring->receiveData == NULL || uring->sendMessages == NULL || uring->sendVectors == NULL ||
+            uring->sendAddresses == NULL || uring->sendData == NULL || uring->freeSlots == NULL ||
+            uring->receiveCompletions == NULL
+        ) {
+            enet_socket_uring_destroy(host);
+            return -1;
+        }
+
+        memset(&uring->receiveHeader, 0, sizeof(struct msghdr));
+        uring->receiveHeader.msg_namelen = sizeof(struct sockaddr_in6);
+        memset(uring->sendMessages, 0, entries * sizeof(struct msghdr));
+
+        for (i = 0; i < entries; ++i) {
+            enet_socket_uring_recycle(uring, (enet_uint16) i);
+
+            uring->sendVectors[i].iov_base = uring->sendData + i * ENET_PROTOCOL_MAXIMUM_MTU;
+            uring->sendMessages[i].msg_iov     = &uring->sendVectors[i];
+            uring->sendMessages[i].msg_iovlen  = 1;
+            uring->sendMessages[i].msg_name    = &uring->sendAddresses[i];
+            uring->sendMessages[i].msg_namelen = sizeof(struct sockaddr_in6);
+
+            uring->freeSlots[i] = (enet_uint32) (entries - 1 - i);
+        }
+        uring->freeSlotCount = entries;
+
+        // The multishot recvmsg is armed on the first receive, from the thread that services the host
+        return 0;
+#else
+        ENET_UNUSED(host)
+        ENET_UNUSED(entries)
+        return -1;
+#endif
+    }
+
+    /** Returns the descriptor that becomes readable when the host has datagrams to receive.
+     *  The io_uring ring when enet_host_socket_uring is enabled, otherwise the host socket
+     */
+    ENetSocket enet_host_wait_socket(ENetHost *host) {
+#ifdef ENET_SOCKET_URING
+        if (host->socketUring != NULL) {
+            return host->socketUring->ringFd;
+        }
+#endif
+        return host->socket;
+    }
+
+    /** Returns 1 if the batching or io_uring backend holds received datagrams the protocol hasn't read yet.
+     *  Waiting on enet_host_wait_socket doesn't see them, service the host again instead
+     */
+    int enet_host_socket_pending(ENetHost *host) {
+#ifdef ENET_SOCKET_URING
+        // Completions set aside while reaping sends are no longer in the CQ
+        if (host->socketUring != NULL) {
+            return host->socketUring->receiveCompletionHead < host->socketUring->receiveCompletionCount;
+        }
+#endif
+#ifdef ENET_SOCKET_BATCH
+        return host->socketBatch != NULL && host->socketBatch->receivedCursor < host->socketBatch->receivedCount;
+#else
+        ENET_UNUSED(host)
+        return 0;
+#endif
+    }
+
     void enet_host_bandwidth_throttle(ENetHost *host) {
         enet_uint32 timeCurrent       = enet_time_get();
         enet_uint32 elapsedTime       = timeCurrent - host->bandwidthThrottleEpoch;
@@ -5606,6 +6487,12 @@ extern "C" {
                 result = setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (char *)&value, sizeof(int));
                 break;
 
+#ifdef SO_REUSEPORT
+            case ENET_SOCKOPT_REUSEPORT:
+                result = setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (char *)&value, sizeof(int));
+                break;
+#endif
+
             case ENET_SOCKOPT_RCVBUF:
                 result = setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (char *)&value, sizeof(int));
                 break;
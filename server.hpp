@@ -1,13 +1,13 @@
 #pragma once
 
 #include "common.hpp"
-#include <unordered_map>
 
 using namespace scarabnet;
 
 class Server {
 	public:
 		Server(const uint16 port, uint16 max_clients, bool show_log = false);
+		Server(const uint16 port, uint16 max_clients, const HostConfig& config);
 		~Server() noexcept;
 
 		// Returns true if the sever has started
@@ -24,59 +24,241 @@ class Server {
 		// Returns true if an event was processed
 		bool poll_event(Event& event) noexcept;
 
-		// Send a packet to a specific client
-		void send(const uint32 client_id, const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE) const;
+		// Moves up to events.size() queued events into the buffer.
+		// Returns the number of events written
+		size_t poll_events(std::span<Event> events) noexcept;
+
+		// Appends every queued event to the vector.
+		// Returns the number of events appended
+		size_t drain_events(std::vector<Event>& events);
+
+		// Waits up to timeout for an event, sleeping instead of spinning.
+		// Returns true if an event was processed
+		template <typename Rep, typename Period>
+		bool wait_event(Event& event, const std::chrono::duration<Rep, Period>& timeout);
+
+		// Waits up to timeout for events, then moves up to events.size() of them into the buffer.
+		// Returns the number of events written
+		template <typename Rep, typename Period>
+		size_t wait_events(std::span<Event> events, const std::chrono::duration<Rep, Period>& timeout);
+
+		// Returns a file descriptor that is readable while there are events to poll,
+		// to wait on the server from an external epoll/poll loop.
+		// Created on first call. Not available on Windows
+		int event_fd();
+
+		// Returns true if events are queued, from the thread polling them
+		inline bool has_events() const noexcept {
+			return !this->events.empty();
+		}
+
+		// Send a packet to a specific client, on one of HostConfig::channels
+		void send(const uint32 client_id, const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE, const uint8 channel = 0);
+
+		// Send a packet built in place to a specific client
+		void send(const uint32 client_id, PacketBuilder&& builder, const uint8 channel = 0);
 
 		// Broadcast a packet to all clients
-		void broadcast(const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE) const;
+		void broadcast(const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE, const uint8 channel = 0);
+
+		// Broadcast a packet built in place to all clients
+		void broadcast(PacketBuilder&& builder, const uint8 channel = 0);
+
+		// Returns the id of a new, empty group of clients. Safe to call from any thread
+		uint32 create_group() noexcept;
+
+		// Creates a group under an id handed out elsewhere, so several servers can share group ids.
+		// Used by ShardedServer, the id must not collide with the ones create_group() returns
+		void create_group(const uint32 group_id) noexcept;
+
+		// Removes every client from the group, its id is not reused
+		void destroy_group(const uint32 group_id) noexcept;
+
+		// Adds a client to a group. Clients leave their groups when they disconnect.
+		// Ignored for groups that don't exist and clients that aren't connected
+		void join(const uint32 group_id, const uint32 client_id) noexcept;
+
+		// Removes a client from a group
+		void leave(const uint32 group_id, const uint32 client_id) noexcept;
+
+		// Send a packet to every client of a group except exclude_id (0 excludes nobody).
+		// The packet is built once and shared by every member
+		void send_group(const uint32 group_id, const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE,
+			const uint8 channel = 0, const uint32 exclude_id = 0);
+
+		// Send a packet built in place to every client of a group except exclude_id
+		void send_group(const uint32 group_id, PacketBuilder&& builder, const uint8 channel = 0, const uint32 exclude_id = 0);
+
+		// Sends out queued packets right away, without waiting for the network thread's next wake up.
+		// With HostConfig::aggregate_size, also sends the packets aggregated since the last flush
+		void flush() noexcept;
+
+		// Services the host on the calling thread, for servers created with HostConfig::network_thread = false.
+		// Waits up to timeout for events and passes each one to handler(Event&&) directly,
+		// without going through the event queue.
+		// Returns the number of events handled
+		template <typename Rep, typename Period, typename F>
+		size_t service(const std::chrono::duration<Rep, Period>& timeout, F&& handler);
+
+		// Same as service, but keeps servicing until deadline
+		template <typename Clock, typename Duration, typename F>
+		size_t service_until(const std::chrono::time_point<Clock, Duration>& deadline, F&& handler);
+
+		// Counters of HostConfig::compress or HostConfig::compressor, all zero without compression.
+		// Safe to call from any thread
+		CompressionStats compression_stats() const noexcept;
+
+		// Sets a handler invoked in place on the thread servicing the host.
+		// Events it consumes are not pushed to the event queue. Set it before start(), nullptr removes it
+		void set_handler(EventHandler* handler) noexcept;
 	private:
+		// Queue a command for the network thread, waiting for room if the queue is full
+		void push_command(Command&& command) noexcept;
+
+		// Queue a Send command for an ENet packet
+		void push_send(const uint32 peer_id, const uint8 channel, ENetPacket* packet) noexcept;
+
+		// Hand queued commands to ENet. Only called by the thread servicing the host
+		void process_commands() noexcept;
+
+		// Hands a packet to ENet, destroying it if that fails
+		void send_to(ENetPeer* peer, const uint8 channel, ENetPacket* packet) noexcept;
+
+		// Send the aggregated bundles on a channel, if aggregating, so a packet sent to several clients doesn't overtake them
+		void flush_bundles(const uint8 channel) noexcept;
+
 		// Listen to events and push to vector of events
 		void network_thread_loop() noexcept; // Loop of thread
 
+		// One pass over the host: hands queued commands to ENet, then passes every ready event to emit.
+		// If nothing was ready, waits up to timeout milliseconds for more
+		template <typename F>
+		size_t service_once(const uint32 timeout, F&& emit);
+
+		// Passes every event ENet has ready to emit
+		template <typename F>
+		size_t dispatch_ready(F&& emit);
+
+		// Turns an ENet event into an Event passed to emit
+		template <typename F>
+		void dispatch(ENetEvent& event, F&& emit);
+
+		// Push an event to the application, waiting for room if the queue is full
+		void push_event(Event&& event) noexcept;
+
+		// Drops a client from every group it joined. Only called by the thread servicing the host
+		void leave_groups(const uint32 client_id, ENetPeer* peer) noexcept;
+
+		// Clear event_fd() readiness once the application took every event
+		void reset_event_fd() noexcept;
+
 		ENetHost* host = nullptr;
 		
+		HostConfig config;
 		bool show_log; // Debug
-		TSQueue<Event> events;
+		// Optional in place event handling, not owned
+		EventHandler* handler = nullptr;
+		// Network thread produces, application thread consumes
+		SPSCQueue<Event> events;
+		// Wakes the application thread blocked in wait_event
+		EventSignal signal;
+		// Application threads produce, network thread consumes
+		MPSCQueue<Command> commands;
+		// Interrupts the network thread's wait when a command is queued
+		Waker waker;
+		// Bundles sent packets until flush(), only with HostConfig::aggregate_size.
+		// Only used by the thread servicing the host
+		std::unique_ptr<PacketAggregator> aggregator;
+		// Compresses the host's datagrams, only with HostConfig::compress or HostConfig::compressor
+		std::unique_ptr<HostCompressor> compressor;
 
 		// Thread
 		std::thread thread;
 		std::atomic<bool> running = false;
 		// atomic avoids data races
-
-		// Connected clients
-		std::unordered_map<uint32, ENetPeer*> clients;
-		// Current Peer id
-		uint32 curid = 1;
-
-		// Used to send packet to a specific client
-		// So its possible to access this->clients safely
-		// This is needed since this->clients is also called inside Server::send
-		mutable std::mutex clients_mutex;
+		// Thread currently servicing the host, network thread or service() caller
+		std::atomic<std::thread::id> service_thread;
+
+		// Connected clients, by id
+		// Only accessed by the network thread, sends reach it through this->commands
+		PeerSlotMap clients;
+		// Client ids of each group, only accessed by the network thread
+		std::unordered_map<uint32, std::vector<uint32>> groups;
+		// Groups each client joined, indexed like the ENet peers, so a disconnect leaves them all
+		std::vector<std::vector<uint32>> memberships;
+		// Id of the next group, never 0
+		std::atomic<uint32> next_group = 1;
 };
 
 
 inline Server::Server(const uint16 port, uint16 max_clients, bool show_log)
-	: show_log(show_log) {
+	: Server(port, max_clients, HostConfig { .show_log = show_log }) {}
+
+inline Server::Server(const uint16 port, uint16 max_clients, const HostConfig& config)
+	: config(config), show_log(config.show_log) {
 
-	if(enet_initialize() != 0) {
+	if(initialize_enet() != 0) {
 		throw std::runtime_error("Failed to initialize ENet");
 	}
 
+	if(max_clients > ENET_PROTOCOL_MAXIMUM_PEER_ID) {
+		deinitialize_enet();
+		throw std::runtime_error("max_clients exceeds the ENet peer limit (build with SCARABNET_LARGE_SERVER)");
+	}
+
+	// Ids hold the slot index in 16 bits
+	if((size_t)config.id_base + max_clients > 0x10000) {
+		deinitialize_enet();
+		throw std::runtime_error("id_base + max_clients exceeds 16 bit client ids");
+	}
+
 	ENetAddress address = { 0 };
 	address.host = ENET_HOST_ANY;
 	address.port = port;
 	this->host = enet_host_create(
-		&address,
+		config.reuse_port ? NULL : &address, // Bound below, the option must be set first
 		max_clients, // Number of clients
-		2, // Allow up to 2 channels to be used (0 and 1)
+		config.channels, // Channels 0 to channels - 1, 0 allows the maximum
 		0, // Assume any amount of incoming bandwidth
 		0  // Assume any amount of outgoing bandwidth
 	);
 
 	if(this->host == NULL) {
+		deinitialize_enet();
 		throw std::runtime_error("Failed to create ENet server host");
 	}
 
+	if(config.reuse_port) {
+		if(enet_socket_set_option(this->host->socket, ENET_SOCKOPT_REUSEPORT, 1) < 0
+			|| enet_socket_bind(this->host->socket, &address) < 0) {
+			enet_host_destroy(this->host);
+			deinitialize_enet();
+			throw std::runtime_error("Failed to bind ENet server host with SO_REUSEPORT");
+		}
+		enet_socket_get_address(this->host->socket, &this->host->address);
+	}
+
+	// io_uring takes over the socket where available, batching is the next best thing
+	if(config.io_uring_entries > 0 && enet_host_socket_uring(this->host, config.io_uring_entries) < 0) {
+		LOG_SERVER("io_uring unavailable, using the socket syscalls");
+	}
+	if(config.socket_batch > 0 && this->host->socketUring == NULL
+		&& enet_host_socket_batch(this->host, config.socket_batch) < 0) {
+		LOG_SERVER("Socket batching unavailable, using one syscall per datagram");
+	}
+	this->clients.resize(this->host->peerCount, config.id_base);
+	this->memberships.resize(this->host->peerCount);
+
+	if(config.aggregate_size > 0) {
+		// Bundles that don't fit in a datagram would be fragmented
+		const size_t limit = std::min<size_t>(config.aggregate_size, PacketAggregator::unfragmented_size(this->host));
+		this->aggregator = std::make_unique<PacketAggregator>(limit, this->host->peerCount);
+	}
+	if(config.compress || config.compressor) {
+		this->compressor = std::make_unique<HostCompressor>(config.compressor);
+		this->compressor->attach(this->host);
+	}
+
 	LOG_SERVER("Started server on port " << port);
 }
 
@@ -85,8 +267,15 @@ inline Server::~Server() noexcept {
 		this->stop();
 	}
 
+	// Free packets that were queued but never handed to ENet
+	this->aggregator.reset();
+	Command command;
+	while(this->commands.pop_front(command)) {
+		enet_packet_destroy(command.packet);
+	}
+
 	enet_host_destroy(this->host);
-	enet_deinitialize();
+	deinitialize_enet();
 }
 
 inline void Server::start() noexcept {
@@ -94,148 +283,498 @@ inline void Server::start() noexcept {
 		return;
 	}
 	this->running = true;
-	this->thread = std::thread(&Server::network_thread_loop, this);
+	// Otherwise the application services the host with service()
+	if(this->config.network_thread) {
+		this->thread = std::thread(&Server::network_thread_loop, this);
+	}
 }
 
 inline void Server::stop() noexcept {
 	this->running = false;
+	this->waker.notify(); // Don't wait out the service timeout
+	this->signal.notify(); // Release threads blocked in wait_event
+	if(this->config.event_signal) {
+		this->config.event_signal->notify();
+	}
 	if(this->thread.joinable()) {
 		this->thread.join();
 	}
 }
 
 inline bool Server::poll_event(Event& event) noexcept {
-	if(this->events.empty()) {
-		return false;
+	const bool polled = this->events.pop_front(event);
+	this->reset_event_fd();
+	return polled;
+}
+
+inline size_t Server::poll_events(std::span<Event> events) noexcept {
+	size_t i = 0;
+	const size_t polled = this->events.pop_bulk(events.size(), [&](Event&& event) {
+		events[i++] = std::move(event);
+	});
+	this->reset_event_fd();
+	return polled;
+}
+
+inline size_t Server::drain_events(std::vector<Event>& events) {
+	events.reserve(events.size() + this->events.count());
+	const size_t polled = this->events.pop_bulk(SIZE_MAX, [&](Event&& event) {
+		events.push_back(std::move(event));
+	});
+	this->reset_event_fd();
+	return polled;
+}
+
+template <typename Rep, typename Period>
+inline bool Server::wait_event(Event& event, const std::chrono::duration<Rep, Period>& timeout) {
+	if(this->poll_event(event)) {
+		return true;
 	}
-	event = this->events.pop_front();
-	return true;
+
+	// Also wake up if the network thread stops, no more events will come
+	this->signal.wait_until(std::chrono::steady_clock::now() + timeout, [this]() {
+		return !this->events.empty() || !this->running;
+	});
+	return this->poll_event(event);
 }
 
-inline void Server::send(const uint32 client_id, const Packet& packet, const PacketFlag flag) const {
-	if(this->running) {
+template <typename Rep, typename Period>
+inline size_t Server::wait_events(std::span<Event> events, const std::chrono::duration<Rep, Period>& timeout) {
+	this->signal.wait_until(std::chrono::steady_clock::now() + timeout, [this]() {
+		return !this->events.empty() || !this->running;
+	});
+	return this->poll_events(events);
+}
+
+inline int Server::event_fd() {
+	return this->signal.fd([this]() {
+		return !this->events.empty();
+	});
+}
+
+inline void Server::reset_event_fd() noexcept {
+	this->signal.reset_fd([this]() {
+		return !this->events.empty();
+	});
+}
+
+inline void Server::send(const uint32 client_id, const Packet& packet, const PacketFlag flag, const uint8 channel) {
+	if(!this->running) {
 		return;
 	}
 
-	const std::vector<uint8> serialized = PacketHelper::serialize_packet(packet);
-	ENetPacket* epacket = enet_packet_create(
-		serialized.data(),
-		serialized.size(),
-		(ENetPacketFlag)flag
-	);
+	this->push_send(client_id, channel, PacketHelper::create_enet_packet(packet, flag));
+}
 
-	// Allocation failed
-	if(epacket == NULL) {
-		LOG_SERVER("Allocation failed while creating packet");
+inline void Server::send(const uint32 client_id, PacketBuilder&& builder, const uint8 channel) {
+	if(!this->running) {
 		return;
 	}
+	this->push_send(client_id, channel, builder.release());
+}
 
-	// Check if client is valid
-	std::scoped_lock lock = std::scoped_lock(this->clients_mutex); // Lock before accessing the map
-	auto it = this->clients.find(client_id);
-	if(it == this->clients.end()) {
-		LOG_SERVER("Client " << client_id << " not found");
+inline void Server::broadcast(const Packet& packet, const PacketFlag flag, const uint8 channel) {
+	if(!this->running) {
 		return;
 	}
+	this->push_command({ .type = Command::Type::Broadcast, .channel = channel, .packet = PacketHelper::create_enet_packet(packet, flag) });
+}
 
-	// Send packet
-	if(enet_peer_send((ENetPeer*)it->second, 0, epacket) < 0) {
-		enet_packet_destroy(epacket); // Clean up on failure
-		LOG_SERVER("Failed to send packet");
+inline void Server::broadcast(PacketBuilder&& builder, const uint8 channel) {
+	if(!this->running) {
 		return;
 	}
+	this->push_command({ .type = Command::Type::Broadcast, .channel = channel, .packet = builder.release() });
+}
 
-	LOG_SERVER("Packet sent!");
+inline uint32 Server::create_group() noexcept {
+	const uint32 group_id = this->next_group.fetch_add(1, std::memory_order_relaxed);
+	this->create_group(group_id);
+	return group_id;
+}
 
-	// immediately send out all queued packets
-	// enet_host_flush((ENetHost*)this->host);
+inline void Server::create_group(const uint32 group_id) noexcept {
+	// Registered by the network thread, ahead of any join queued after this
+	this->push_command({ .type = Command::Type::CreateGroup, .group_id = group_id });
 }
 
-inline void Server::broadcast(const Packet& packet, const PacketFlag flag) const {
-	if(this->running) {
+inline void Server::destroy_group(const uint32 group_id) noexcept {
+	this->push_command({ .type = Command::Type::DestroyGroup, .group_id = group_id });
+}
+
+inline void Server::join(const uint32 group_id, const uint32 client_id) noexcept {
+	this->push_command({ .type = Command::Type::Join, .peer_id = client_id, .group_id = group_id });
+}
+
+inline void Server::leave(const uint32 group_id, const uint32 client_id) noexcept {
+	this->push_command({ .type = Command::Type::Leave, .peer_id = client_id, .group_id = group_id });
+}
+
+inline void Server::send_group(const uint32 group_id, const Packet& packet, const PacketFlag flag, const uint8 channel, const uint32 exclude_id) {
+	if(!this->running) {
 		return;
 	}
+	this->push_command({
+		.type     = Command::Type::GroupSend,
+		.peer_id  = exclude_id,
+		.channel  = channel,
+		.group_id = group_id,
+		.packet   = PacketHelper::create_enet_packet(packet, flag)
+	});
+}
 
-	const std::vector<uint8> buffer = PacketHelper::serialize_packet(packet);
-	ENetPacket* epacket = enet_packet_create(
-		buffer.data(),
-		buffer.size(),
-		(ENetPacketFlag)flag
-	);
+inline void Server::send_group(const uint32 group_id, PacketBuilder&& builder, const uint8 channel, const uint32 exclude_id) {
+	if(!this->running) {
+		return;
+	}
+	this->push_command({
+		.type     = Command::Type::GroupSend,
+		.peer_id  = exclude_id,
+		.channel  = channel,
+		.group_id = group_id,
+		.packet   = builder.release()
+	});
+}
 
+inline void Server::flush() noexcept {
+	if(!this->running) {
+		return;
+	}
+	this->push_command({ .type = Command::Type::Flush });
+}
+
+inline void Server::push_command(Command&& command) noexcept {
 	// Allocation failed
-	if(epacket == NULL) {
+	if((command.type == Command::Type::Send || command.type == Command::Type::Broadcast || command.type == Command::Type::GroupSend)
+		&& command.packet == NULL) {
 		LOG_SERVER("Allocation failed while creating packet");
 		return;
 	}
 
-	// Broadcast packet
-	enet_host_broadcast((ENetHost*)this->host, 0, epacket);
-
-	LOG_SERVER("Broadcasted packet!");
+	// Queue is bounded, hold the caller until the network thread catches up
+	while(!this->commands.push_back(std::move(command))) {
+		if(!this->running) {
+			enet_packet_destroy(command.packet);
+			return;
+		}
+		// Sending from the thread servicing the host (e.g. inside a handler), nobody else will drain the queue
+		if(std::this_thread::get_id() == this->service_thread.load(std::memory_order_relaxed)) {
+			this->process_commands();
+			continue;
+		}
+		std::this_thread::yield();
+	}
+	this->waker.notify();
 }
 
+inline void Server::push_send(const uint32 peer_id, const uint8 channel, ENetPacket* packet) noexcept {
+	this->push_command({ .type = Command::Type::Send, .peer_id = peer_id, .channel = channel, .packet = packet });
+}
 
-inline void Server::network_thread_loop() noexcept {
-	while(this->running) {
-		ENetEvent event;
-
-		// Wait 5ms for a new event
-		while(enet_host_service(this->host, &event, 5) > 0) {
-			switch (event.type) {
-				case ENET_EVENT_TYPE_CONNECT: {
-					// Lock before accessing this->clients
-					std::scoped_lock lock = std::scoped_lock(this->clients_mutex);
-
-					// New ID
-					const uint32 newid = this->curid++;
-					this->clients[newid] = event.peer;
-
-					// Store the id on the peer itself for quick lookups
-					event.peer->data = (void*)((uintptr_t)newid);
-					// Push packet
-					this->events.push_back({ .peer_id = newid, .type = EventType::Connect });
+inline void Server::process_commands() noexcept {
+	Command command;
+	while(this->commands.pop_front(command)) {
+		switch(command.type) {
+			case Command::Type::Send: {
+				// Check if client is valid
+				ENetPeer* peer = this->clients.find(command.peer_id);
+				if(peer == nullptr) {
+					enet_packet_destroy(command.packet);
+					LOG_SERVER("Client " << command.peer_id << " not found");
+					break;
+				}
 
-					LOG_SERVER("Client " << newid << " connected");
+				// Bundled until the next flush when aggregating
+				if(this->aggregator) {
+					this->aggregator->append(peer, command.channel, command.packet, [this](ENetPeer* target, const uint8 channel, ENetPacket* packet) {
+						this->send_to(target, channel, packet);
+					});
 					break;
 				}
+				this->send_to(peer, command.channel, command.packet);
+				break;
+			}
 
-				case ENET_EVENT_TYPE_RECEIVE: {
-					const uint32 peerid = (uintptr_t)event.peer->data;
-					LOG_SERVER("Packet received from peer " << peerid);
+			case Command::Type::Broadcast: {
+				this->flush_bundles(command.channel);
+				enet_host_broadcast(this->host, command.channel, command.packet);
+				LOG_SERVER("Broadcasted packet!");
+				break;
+			}
 
-					// Create an event with data inside
-					this->events.push_back({
-						.peer_id = peerid,
-						.type    = EventType::Receive,
-						.packet  = PacketHelper::deserialize_packet(event.packet->data, event.packet->dataLength)
+			case Command::Type::Flush: {
+				if(this->aggregator) {
+					this->aggregator->flush([this](ENetPeer* target, const uint8 channel, ENetPacket* packet) {
+						this->send_to(target, channel, packet);
 					});
-
-					// This data was copied to the packet
-					// which was moved to the queue
-					enet_packet_destroy(event.packet);
-					break;
 				}
+				enet_host_flush(this->host);
+				break;
+			}
 
-				case ENET_EVENT_TYPE_DISCONNECT:
-				case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
-					// Lock before accessing this->clients
-					std::scoped_lock lock = std::scoped_lock(this->clients_mutex);
+			case Command::Type::CreateGroup: {
+				this->groups.try_emplace(command.group_id);
+				break;
+			}
 
-					const uint32 peerid = (uintptr_t)event.peer->data;
-					// Remove from connected clients
-					this->clients.erase(peerid);
-					// Push event
-					this->events.push_back({ .peer_id = peerid, .type = EventType::Disconnect });
+			case Command::Type::Join: {
+				auto group = this->groups.find(command.group_id);
+				ENetPeer* peer = this->clients.find(command.peer_id);
+				// Destroyed or never created group, or the client is gone
+				if(group == this->groups.end() || peer == nullptr) {
+					break;
+				}
+				std::vector<uint32>& members = group->second;
+				if(std::find(members.begin(), members.end(), command.peer_id) == members.end()) {
+					members.push_back(command.peer_id);
+					this->memberships[peer->incomingPeerID].push_back(command.group_id);
+				}
+				break;
+			}
 
-					LOG_SERVER("Client " << peerid << " disconnected");
+			case Command::Type::Leave: {
+				auto group = this->groups.find(command.group_id);
+				if(group == this->groups.end()) {
 					break;
 				}
+				remove_id(group->second, command.peer_id);
+				if(ENetPeer* peer = this->clients.find(command.peer_id)) {
+					remove_id(this->memberships[peer->incomingPeerID], command.group_id);
+				}
+				break;
+			}
 
-				default:
+			case Command::Type::DestroyGroup: {
+				auto group = this->groups.find(command.group_id);
+				if(group == this->groups.end()) {
 					break;
+				}
+				for(const uint32 member : group->second) {
+					if(ENetPeer* peer = this->clients.find(member)) {
+						remove_id(this->memberships[peer->incomingPeerID], command.group_id);
+					}
+				}
+				this->groups.erase(group);
+				break;
 			}
+
+			case Command::Type::GroupSend: {
+				this->flush_bundles(command.channel);
+				auto group = this->groups.find(command.group_id);
+				if(group != this->groups.end()) {
+					std::vector<uint32>& members = group->second;
+					for(size_t i = 0; i < members.size();) {
+						ENetPeer* peer = this->clients.find(members[i]);
+						// Disconnects leave their groups, this only guards against a stale id
+						if(peer == nullptr) {
+							members[i] = members.back();
+							members.pop_back();
+							continue;
+						}
+						// Every member references the same packet
+						if(members[i] != command.peer_id) {
+							enet_peer_send(peer, command.channel, command.packet);
+						}
+						i++;
+					}
+				}
+
+				// Nobody to send it to
+				if(command.packet->referenceCount == 0) {
+					enet_packet_destroy(command.packet);
+				}
+				LOG_SERVER("Sent packet to group " << command.group_id);
+				break;
+			}
+
+			default:
+				enet_packet_destroy(command.packet);
+				break;
+		}
+	}
+}
+
+inline void Server::send_to(ENetPeer* peer, const uint8 channel, ENetPacket* packet) noexcept {
+	if(packet == NULL) {
+		LOG_SERVER("Allocation failed while creating packet");
+		return;
+	}
+	// Fails if the channel is out of range
+	if(enet_peer_send(peer, channel, packet) < 0) {
+		enet_packet_destroy(packet); // Clean up on failure
+		LOG_SERVER("Failed to send packet on channel " << (int)channel);
+		return;
+	}
+	LOG_SERVER("Packet sent!");
+}
+
+inline void Server::flush_bundles(const uint8 channel) noexcept {
+	if(!this->aggregator) {
+		return;
+	}
+	this->aggregator->flush(channel, [this](ENetPeer* target, const uint8 bundle_channel, ENetPacket* packet) {
+		this->send_to(target, bundle_channel, packet);
+	});
+}
+
+inline void Server::push_event(Event&& event) noexcept {
+	// Queue is bounded, hold the network thread until the application catches up
+	while(!this->events.push_back(std::move(event))) {
+		if(!this->running) {
+			return;
+		}
+		// Keep sends flowing, the application may be waiting on them before polling
+		this->process_commands();
+		std::this_thread::yield();
+	}
+	this->signal.notify();
+	if(this->config.event_signal) {
+		this->config.event_signal->notify();
+	}
+}
+
+inline void Server::leave_groups(const uint32 client_id, ENetPeer* peer) noexcept {
+	std::vector<uint32>& joined = this->memberships[peer->incomingPeerID];
+	for(const uint32 group_id : joined) {
+		auto group = this->groups.find(group_id);
+		if(group != this->groups.end()) {
+			remove_id(group->second, client_id);
 		}
 	}
+	// Keeps its capacity for the next client in this slot
+	joined.clear();
+}
+
+inline CompressionStats Server::compression_stats() const noexcept {
+	return this->compressor ? this->compressor->stats() : CompressionStats {};
+}
+
+inline void Server::set_handler(EventHandler* handler) noexcept {
+	this->handler = handler;
+}
+
+template <typename Rep, typename Period, typename F>
+inline size_t Server::service(const std::chrono::duration<Rep, Period>& timeout, F&& handler) {
+	if(!this->running || this->thread.joinable()) {
+		LOG_SERVER("service() needs a started server without a network thread");
+		return 0;
+	}
+
+	this->service_thread = std::this_thread::get_id();
+	return this->service_once((uint32)std::chrono::ceil<std::chrono::milliseconds>(timeout).count(), handler);
+}
+
+template <typename Clock, typename Duration, typename F>
+inline size_t Server::service_until(const std::chrono::time_point<Clock, Duration>& deadline, F&& handler) {
+	if(!this->running || this->thread.joinable()) {
+		LOG_SERVER("service_until() needs a started server without a network thread");
+		return 0;
+	}
+
+	this->service_thread = std::this_thread::get_id();
+	size_t count = 0;
+	do {
+		const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+		count += this->service_once((uint32)std::max<int64_t>(remaining.count(), 0), handler);
+	} while(this->running && Clock::now() < deadline);
+	return count;
+}
+
+inline void Server::network_thread_loop() noexcept {
+	this->service_thread = std::this_thread::get_id();
+	while(this->running) {
+		this->service_once(this->config.service_timeout, [this](Event&& event) {
+			this->push_event(std::move(event));
+		});
+	}
+}
+
+template <typename F>
+inline size_t Server::service_once(const uint32 timeout, F&& emit) {
+	// Hand queued sends to ENet, so they go out in this service call
+	this->process_commands();
+
+	size_t count = this->dispatch_ready(emit);
+	if(count == 0 && timeout > 0) {
+		// Nothing ready, sleep until a datagram arrives, a command is queued or the timeout passes
+		this->waker.wait(enet_host_wait_socket(this->host), timeout, [this]() {
+			return !this->commands.empty() || enet_host_socket_pending(this->host);
+		});
+
+		this->process_commands();
+		count = this->dispatch_ready(emit);
+	}
+	return count;
+}
+
+template <typename F>
+inline size_t Server::dispatch_ready(F&& emit) {
+	size_t count = 0;
+	ENetEvent event;
+	while(enet_host_service(this->host, &event, 0) > 0) {
+		this->dispatch(event, emit);
+		count++;
+	}
+	return count;
 }
 
+template <typename F>
+inline void Server::dispatch(ENetEvent& event, F&& emit) {
+	switch (event.type) {
+		case ENET_EVENT_TYPE_CONNECT: {
+			// New ID
+			const uint32 newid = this->clients.insert(event.peer);
+
+			// Store the id on the peer itself for quick lookups
+			event.peer->data = (void*)((uintptr_t)newid);
+			// Push packet
+			if(!this->handler || !this->handler->on_connect(newid)) {
+				emit(Event { .peer_id = newid, .type = EventType::Connect });
+			}
+
+			LOG_SERVER("Client " << newid << " connected");
+			break;
+		}
+
+		case ENET_EVENT_TYPE_RECEIVE: {
+			const uint32 peerid = (uintptr_t)event.peer->data;
+			LOG_SERVER("Packet received from peer " << peerid);
+
+			// Only aggregating hosts expect bundles, elsewhere BUNDLE_TYPE is a plain header type
+			if(this->aggregator && PacketHelper::receive_bundle(this->handler, peerid, event.channelID, event.packet, emit)) {
+				break;
+			}
+			if(PacketHelper::handle_packet(this->handler, peerid, event.packet)) {
+				break;
+			}
+
+			// Create an event with data inside
+			Event received = { .peer_id = peerid, .type = EventType::Receive, .channel = event.channelID };
+			PacketHelper::receive_packet(received, event.packet, this->config.zero_copy);
+			emit(std::move(received));
+			break;
+		}
+
+		case ENET_EVENT_TYPE_DISCONNECT:
+		case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT: {
+			const uint32 peerid = (uintptr_t)event.peer->data;
+			this->leave_groups(peerid, event.peer);
+			if(this->aggregator) {
+				this->aggregator->discard(event.peer);
+			}
+			// Remove from connected clients
+			this->clients.erase(peerid);
+			event.peer->data = nullptr;
+			// Push event
+			if(!this->handler || !this->handler->on_disconnect(peerid)) {
+				emit(Event { .peer_id = peerid, .type = EventType::Disconnect });
+			}
+
+			LOG_SERVER("Client " << peerid << " disconnected");
+			break;
+		}
+
+		default:
+			break;
+	}
+}
@@ -0,0 +1,341 @@
+#pragma once
+
+#include "server.hpp"
+
+using namespace scarabnet;
+
+// Several servers listening on the same port with SO_REUSEPORT, each with its own host and network thread.
+// The kernel spreads clients across the shards, events are merged into one stream
+// and client ids are unique across every shard
+class ShardedServer {
+	public:
+		ShardedServer(const uint16 port, uint16 max_clients, const size_t shard_count, bool show_log = false);
+		ShardedServer(const uint16 port, uint16 max_clients, const size_t shard_count, const HostConfig& config);
+
+		// Returns true if the shards have started
+		inline bool isrunning() const noexcept {
+			return this->shards.front()->isrunning();
+		}
+
+		// Number of hosts, each serviced by its own network thread
+		inline size_t shard_count() const noexcept {
+			return this->shards.size();
+		}
+
+		// Starts the network thread of every shard
+		void start() noexcept;
+
+		// Stops the network thread of every shard
+		void stop() noexcept;
+
+		// Returns true if an event was processed.
+		// Shards are taken in turn so a busy one can't starve the others
+		bool poll_event(Event& event) noexcept;
+
+		// Moves up to events.size() queued events of all shards into the buffer.
+		// Returns the number of events written
+		size_t poll_events(std::span<Event> events) noexcept;
+
+		// Appends every queued event of all shards to the vector.
+		// Returns the number of events appended
+		size_t drain_events(std::vector<Event>& events);
+
+		// Waits up to timeout for an event of any shard, sleeping instead of spinning.
+		// Returns true if an event was processed
+		template <typename Rep, typename Period>
+		bool wait_event(Event& event, const std::chrono::duration<Rep, Period>& timeout);
+
+		// Waits up to timeout for events of any shard, then moves up to events.size() of them into the buffer.
+		// Returns the number of events written
+		template <typename Rep, typename Period>
+		size_t wait_events(std::span<Event> events, const std::chrono::duration<Rep, Period>& timeout);
+
+		// Returns a file descriptor that is readable while any shard has events to poll,
+		// to wait on the shards from an external epoll/poll loop.
+		// Created on first call. Not available on Windows
+		int event_fd();
+
+		// Send a packet to a specific client, on one of HostConfig::channels
+		void send(const uint32 client_id, const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE, const uint8 channel = 0);
+
+		// Send a packet built in place to a specific client
+		void send(const uint32 client_id, PacketBuilder&& builder, const uint8 channel = 0);
+
+		// Broadcast a packet to all clients of every shard
+		void broadcast(const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE, const uint8 channel = 0);
+
+		// Broadcast a packet built in place to all clients of every shard
+		void broadcast(PacketBuilder&& builder, const uint8 channel = 0);
+
+		// Returns the id of a new, empty group of clients, which may span shards
+		uint32 create_group() noexcept;
+
+		// Removes every client from the group on every shard
+		void destroy_group(const uint32 group_id) noexcept;
+
+		// Adds a client to a group, on the shard owning the client
+		void join(const uint32 group_id, const uint32 client_id) noexcept;
+
+		// Removes a client from a group
+		void leave(const uint32 group_id, const uint32 client_id) noexcept;
+
+		// Send a packet to every client of a group except exclude_id (0 excludes nobody).
+		// Built once per shard and shared by the group members of that shard
+		void send_group(const uint32 group_id, const Packet& packet, const PacketFlag flag = PacketFlag::RELIABLE,
+			const uint8 channel = 0, const uint32 exclude_id = 0);
+
+		// Send a packet built in place to every client of a group except exclude_id
+		void send_group(const uint32 group_id, PacketBuilder&& builder, const uint8 channel = 0, const uint32 exclude_id = 0);
+
+		// Sends out queued packets of every shard right away
+		void flush() noexcept;
+
+		// Counters of HostConfig::compress or HostConfig::compressor, summed over every shard
+		CompressionStats compression_stats() const noexcept;
+
+		// Sets a handler invoked in place on the network threads.
+		// It is called from every shard's thread at once, so it must be thread safe
+		void set_handler(EventHandler* handler) noexcept;
+	private:
+		// Returns the shard owning this client id, or nullptr if it is out of range
+		Server* shard_of(const uint32 client_id) const noexcept;
+
+		// Returns true if any shard has queued events
+		bool has_events() const noexcept;
+
+		// Clear event_fd() readiness once the application took every event
+		void reset_event_fd() noexcept;
+
+		// Notified by every shard, declared first so it outlives them
+		EventSignal signal;
+		std::vector<std::unique_ptr<Server>> shards;
+		// Client ids of shard i start at i * clients_per_shard
+		uint16 clients_per_shard = 0;
+		// Shard poll_event looks at first
+		size_t next_shard = 0;
+};
+
+
+
+inline ShardedServer::ShardedServer(const uint16 port, uint16 max_clients, const size_t shard_count, bool show_log)
+	: ShardedServer(port, max_clients, shard_count, HostConfig { .show_log = show_log }) {}
+
+inline ShardedServer::ShardedServer(const uint16 port, uint16 max_clients, const size_t shard_count, const HostConfig& config) {
+	if(shard_count == 0) {
+		throw std::runtime_error("ShardedServer needs at least one shard");
+	}
+
+	// Every shard services itself, and all of them share the port
+	HostConfig shard_config = config;
+	shard_config.network_thread = true;
+	shard_config.reuse_port     = true;
+	shard_config.event_signal   = &this->signal;
+
+	// Ids hold the slot index in 16 bits, shards split that range
+	const size_t per_shard = std::min<size_t>((max_clients + shard_count - 1) / shard_count, 0x10000 / shard_count);
+	if(per_shard == 0) {
+		throw std::runtime_error("Too many shards for max_clients");
+	}
+	this->clients_per_shard = (uint16)per_shard;
+
+	this->shards.reserve(shard_count);
+	for(size_t i = 0; i < shard_count; i++) {
+		shard_config.id_base = (uint16)(i * per_shard);
+		this->shards.push_back(std::make_unique<Server>(port, this->clients_per_shard, shard_config));
+	}
+}
+
+inline void ShardedServer::start() noexcept {
+	for(auto& shard : this->shards) {
+		shard->start();
+	}
+}
+
+inline void ShardedServer::stop() noexcept {
+	for(auto& shard : this->shards) {
+		shard->stop();
+	}
+}
+
+inline bool ShardedServer::poll_event(Event& event) noexcept {
+	for(size_t i = 0; i < this->shards.size(); i++) {
+		Server& shard = *this->shards[this->next_shard];
+		this->next_shard = (this->next_shard + 1) % this->shards.size();
+		if(shard.poll_event(event)) {
+			this->reset_event_fd();
+			return true;
+		}
+	}
+	this->reset_event_fd();
+	return false;
+}
+
+inline size_t ShardedServer::poll_events(std::span<Event> events) noexcept {
+	size_t polled = 0;
+	for(size_t i = 0; i < this->shards.size() && polled < events.size(); i++) {
+		Server& shard = *this->shards[this->next_shard];
+		this->next_shard = (this->next_shard + 1) % this->shards.size();
+		polled += shard.poll_events(events.subspan(polled));
+	}
+	this->reset_event_fd();
+	return polled;
+}
+
+inline size_t ShardedServer::drain_events(std::vector<Event>& events) {
+	size_t polled = 0;
+	for(auto& shard : this->shards) {
+		polled += shard->drain_events(events);
+	}
+	this->reset_event_fd();
+	return polled;
+}
+
+template <typename Rep, typename Period>
+inline bool ShardedServer::wait_event(Event& event, const std::chrono::duration<Rep, Period>& timeout) {
+	if(this->poll_event(event)) {
+		return true;
+	}
+
+	// Also wake up if the shards stop, no more events will come
+	this->signal.wait_until(std::chrono::steady_clock::now() + timeout, [this]() {
+		return this->has_events() || !this->isrunning();
+	});
+	return this->poll_event(event);
+}
+
+template <typename Rep, typename Period>
+inline size_t ShardedServer::wait_events(std::span<Event> events, const std::chrono::duration<Rep, Period>& timeout) {
+	this->signal.wait_until(std::chrono::steady_clock::now() + timeout, [this]() {
+		return this->has_events() || !this->isrunning();
+	});
+	return this->poll_events(events);
+}
+
+inline int ShardedServer::event_fd() {
+	return this->signal.fd([this]() {
+		return this->has_events();
+	});
+}
+
+inline bool ShardedServer::has_events() const noexcept {
+	for(const auto& shard : this->shards) {
+		if(shard->has_events()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void ShardedServer::reset_event_fd() noexcept {
+	this->signal.reset_fd([this]() {
+		return this->has_events();
+	});
+}
+
+inline Server* ShardedServer::shard_of(const uint32 client_id) const noexcept {
+	const size_t index = (client_id & 0xFFFF) / this->clients_per_shard;
+	return index < this->shards.size() ? this->shards[index].get() : nullptr;
+}
+
+inline void ShardedServer::send(const uint32 client_id, const Packet& packet, const PacketFlag flag, const uint8 channel) {
+	if(Server* shard = this->shard_of(client_id)) {
+		shard->send(client_id, packet, flag, channel);
+	}
+}
+
+inline void ShardedServer::send(const uint32 client_id, PacketBuilder&& builder, const uint8 channel) {
+	if(Server* shard = this->shard_of(client_id)) {
+		shard->send(client_id, std::move(builder), channel);
+	}
+}
+
+inline void ShardedServer::broadcast(const Packet& packet, const PacketFlag flag, const uint8 channel) {
+	// Each host gets its own packet, ENet's reference count is not thread safe
+	for(auto& shard : this->shards) {
+		shard->broadcast(packet, flag, channel);
+	}
+}
+
+inline void ShardedServer::broadcast(PacketBuilder&& builder, const uint8 channel) {
+	if(!builder || !this->isrunning()) {
+		return;
+	}
+
+	// Each host gets its own copy, ENet's reference count is not thread safe
+	for(size_t i = 1; i < this->shards.size(); i++) {
+		this->shards[i]->broadcast(builder.copy(), channel);
+	}
+	this->shards.front()->broadcast(std::move(builder), channel);
+}
+
+inline uint32 ShardedServer::create_group() noexcept {
+	// Every shard keys its members by the same id, the first shard hands them out
+	const uint32 group_id = this->shards.front()->create_group();
+	for(size_t i = 1; i < this->shards.size(); i++) {
+		this->shards[i]->create_group(group_id);
+	}
+	return group_id;
+}
+
+inline void ShardedServer::destroy_group(const uint32 group_id) noexcept {
+	for(auto& shard : this->shards) {
+		shard->destroy_group(group_id);
+	}
+}
+
+inline void ShardedServer::join(const uint32 group_id, const uint32 client_id) noexcept {
+	if(Server* shard = this->shard_of(client_id)) {
+		shard->join(group_id, client_id);
+	}
+}
+
+inline void ShardedServer::leave(const uint32 group_id, const uint32 client_id) noexcept {
+	if(Server* shard = this->shard_of(client_id)) {
+		shard->leave(group_id, client_id);
+	}
+}
+
+inline void ShardedServer::send_group(const uint32 group_id, const Packet& packet, const PacketFlag flag, const uint8 channel, const uint32 exclude_id) {
+	// Each host gets its own packet, ENet's reference count is not thread safe
+	for(auto& shard : this->shards) {
+		shard->send_group(group_id, packet, flag, channel, exclude_id);
+	}
+}
+
+inline void ShardedServer::send_group(const uint32 group_id, PacketBuilder&& builder, const uint8 channel, const uint32 exclude_id) {
+	if(!builder || !this->isrunning()) {
+		return;
+	}
+
+	// Each host gets its own copy, ENet's reference count is not thread safe
+	for(size_t i = 1; i < this->shards.size(); i++) {
+		this->shards[i]->send_group(group_id, builder.copy(), channel, exclude_id);
+	}
+	this->shards.front()->send_group(group_id, std::move(builder), channel, exclude_id);
+}
+
+inline void ShardedServer::flush() noexcept {
+	for(auto& shard : this->shards) {
+		shard->flush();
+	}
+}
+
+inline CompressionStats ShardedServer::compression_stats() const noexcept {
+	CompressionStats total;
+	for(const auto& shard : this->shards) {
+		const CompressionStats stats = shard->compression_stats();
+		total.datagrams  += stats.datagrams;
+		total.compressed += stats.compressed;
+		total.bytes_in   += stats.bytes_in;
+		total.bytes_out  += stats.bytes_out;
+		total.received   += stats.received;
+		total.failures   += stats.failures;
+	}
+	return total;
+}
+
+inline void ShardedServer::set_handler(EventHandler* handler) noexcept {
+	for(auto& shard : this->shards) {
+		shard->set_handler(handler);
+	}
+}
@@ -0,0 +1,247 @@
+#include "server.hpp"
+#include "client.hpp"
+#include "check.hpp"
+
+#include <tuple>
+#include <vector>
+
+namespace {
+
+ENetPacket* make_packet(const uint32 type, const PacketFlag flag, const size_t size = 4) {
+	Packet packet;
+	packet.header.type = type;
+	const std::vector<uint8> payload(size, 1);
+	packet.putdata(payload.data(), payload.size());
+	return PacketHelper::create_enet_packet(packet, flag);
+}
+
+// Bundles are emitted in send order: a flag change or an oversized message closes the open bundle first
+void emit_order() {
+	PacketAggregator aggregator(1200, 4);
+	ENetPeer peers[2] = {};
+	peers[0].channelCount = 2;
+	peers[0].incomingPeerID = 0;
+	peers[1].channelCount = 2;
+	peers[1].incomingPeerID = 3;
+
+	// Peer, channel, flags and size of each emitted packet
+	std::vector<std::tuple<ENetPeer*, uint8, uint32, size_t>> emitted;
+	auto emit = [&](ENetPeer* peer, const uint8 channel, ENetPacket* packet) {
+		CHECK(packet != nullptr);
+		emitted.emplace_back(peer, channel, packet->flags, packet->dataLength);
+		enet_packet_destroy(packet);
+	};
+
+	const size_t single = sizeof(Packet::Header) + 4;
+	const size_t bundled = sizeof(Packet::Header) + 2 * (sizeof(uint16) + single);
+
+	aggregator.append(&peers[1], 1, make_packet(1, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[0], 0, make_packet(2, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[0], 0, make_packet(3, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[0], 0, make_packet(4, PacketFlag::UNSEQUENCED), emit);
+	aggregator.append(&peers[0], 0, make_packet(5, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[0], 0, make_packet(6, PacketFlag::RELIABLE, 3000), emit);
+	aggregator.append(&peers[0], 5, make_packet(7, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[0], 1, make_packet(8, PacketFlag::UNSEQUENCED), emit);
+	aggregator.flush(emit);
+
+	const std::vector<std::tuple<ENetPeer*, uint8, uint32, size_t>> expected = {
+		{ &peers[0], 0, ENET_PACKET_FLAG_RELIABLE, bundled },                          // 2 and 3, closed by the flag change
+		{ &peers[0], 0, ENET_PACKET_FLAG_UNSEQUENCED, single },                        // 4 alone goes out unwrapped
+		{ &peers[0], 0, ENET_PACKET_FLAG_RELIABLE, single },                           // 5, closed by the big message
+		{ &peers[0], 0, ENET_PACKET_FLAG_RELIABLE, sizeof(Packet::Header) + 3000 },    // 6, too big to bundle
+		{ &peers[0], 5, ENET_PACKET_FLAG_RELIABLE, single },                           // 7, left for ENet to reject
+		{ &peers[1], 1, ENET_PACKET_FLAG_RELIABLE, single },                           // flush, in opening order
+		{ &peers[0], 1, ENET_PACKET_FLAG_UNSEQUENCED, single },
+	};
+	CHECK(emitted == expected);
+
+	// A disconnected peer's bundles are dropped
+	emitted.clear();
+	aggregator.append(&peers[0], 1, make_packet(9, PacketFlag::RELIABLE), emit);
+	aggregator.discard(&peers[0]);
+	aggregator.flush(emit);
+	CHECK(emitted.empty());
+
+	// Flushing a channel leaves the bundles on the others open
+	aggregator.append(&peers[0], 0, make_packet(10, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[1], 1, make_packet(11, PacketFlag::RELIABLE), emit);
+	aggregator.append(&peers[0], 1, make_packet(12, PacketFlag::RELIABLE), emit);
+	aggregator.flush(1, emit);
+	CHECK((emitted == std::vector<std::tuple<ENetPeer*, uint8, uint32, size_t>>{
+		{ &peers[1], 1, ENET_PACKET_FLAG_RELIABLE, single },
+		{ &peers[0], 1, ENET_PACKET_FLAG_RELIABLE, single },
+	}));
+	emitted.clear();
+	aggregator.flush(emit);
+	CHECK((emitted == std::vector<std::tuple<ENetPeer*, uint8, uint32, size_t>>{ { &peers[0], 0, ENET_PACKET_FLAG_RELIABLE, single } }));
+}
+
+// Bundles are capped to what ENet sends without fragmenting, which would make them reliable
+void datagram_limit() {
+	ENetHost host = {};
+	host.mtu = ENET_HOST_DEFAULT_MTU;
+	const size_t limit = PacketAggregator::unfragmented_size(&host);
+	CHECK(limit == ENET_HOST_DEFAULT_MTU - sizeof(ENetProtocolHeader) - sizeof(ENetProtocolSendFragment));
+
+	PacketAggregator aggregator(limit, 1);
+	ENetPeer peer = {};
+	peer.channelCount = 1;
+	std::vector<size_t> sizes;
+	auto emit = [&](ENetPeer*, const uint8, ENetPacket* packet) {
+		CHECK(packet != nullptr);
+		sizes.push_back(packet->dataLength);
+		enet_packet_destroy(packet);
+	};
+	for(uint32 i = 0; i < 100; i++) {
+		aggregator.append(&peer, 0, make_packet(i, PacketFlag::UNSEQUENCED, 100), emit);
+	}
+	aggregator.flush(emit);
+	CHECK(sizes.size() > 1);
+	for(const size_t size : sizes) {
+		CHECK(size <= limit);
+	}
+}
+
+// Messages sent between flushes arrive as separate events, in order
+void loopback() {
+	HostConfig config;
+	config.network_thread = false;
+	config.aggregate_size = 1200;
+
+	Server server(47017, 4, config);
+	server.start();
+	Client client(config);
+	client.connect("127.0.0.1", 47017);
+
+	constexpr uint32 COUNT = 300;
+	std::vector<uint32> received;
+	bool sent = false;
+	auto step = [&]() {
+		server.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type == EventType::Receive) {
+				received.push_back(event.packet->header.type);
+			}
+		});
+		client.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type != EventType::Connect || sent) {
+				return;
+			}
+			sent = true;
+			for(uint32 i = 0; i < COUNT; i++) {
+				Packet packet;
+				packet.header.type = i;
+				// One message too big to bundle in the middle
+				const std::vector<uint8> payload(i == COUNT / 2 ? 3000 : 4, (uint8)i);
+				packet.putdata(payload.data(), payload.size());
+				client.send(packet);
+			}
+			client.flush();
+		});
+	};
+	CHECK(run_until(std::chrono::seconds(5), step, [&]() { return received.size() >= COUNT; }));
+
+	CHECK(received.size() == COUNT);
+	for(uint32 i = 0; i < COUNT; i++) {
+		CHECK(received[i] == i);
+	}
+}
+
+// Broadcasts and group sends don't overtake the bundled sends before them
+void send_order() {
+	HostConfig config;
+	config.network_thread = false;
+	config.aggregate_size = 1200;
+
+	Server server(47020, 4, config);
+	server.start();
+	Client client(config);
+	client.connect("127.0.0.1", 47020);
+
+	std::vector<uint32> received;
+	bool sent = false;
+	auto step = [&]() {
+		server.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type != EventType::Connect || sent) {
+				return;
+			}
+			sent = true;
+			const uint32 group = server.create_group();
+			server.join(group, event.peer_id);
+			uint32 type = 0;
+			auto next = [&]() {
+				Packet packet;
+				packet.header.type = type++;
+				packet.putdata(&type, sizeof(type));
+				return packet;
+			};
+			for(size_t i = 0; i < 5; i++) {
+				server.send(event.peer_id, next());
+			}
+			server.broadcast(next());
+			for(size_t i = 0; i < 5; i++) {
+				server.send(event.peer_id, next());
+			}
+			server.send_group(group, next());
+			server.send(event.peer_id, next());
+			server.flush();
+		});
+		client.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type == EventType::Receive) {
+				received.push_back(event.packet->header.type);
+			}
+		});
+	};
+	CHECK(run_until(std::chrono::seconds(5), step, [&]() { return received.size() >= 13; }));
+
+	CHECK(received.size() == 13);
+	for(uint32 i = 0; i < 13; i++) {
+		CHECK(received[i] == i);
+	}
+}
+
+
+// Hosts that don't aggregate deliver BUNDLE_TYPE packets as they are
+void plain_bundle_type() {
+	HostConfig config;
+	config.network_thread = false;
+
+	Server server(47021, 4, config);
+	server.start();
+	Client client(config);
+	client.connect("127.0.0.1", 47021);
+
+	std::vector<uint32> received;
+	auto step = [&]() {
+		server.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type == EventType::Receive) {
+				received.push_back(event.packet->header.type);
+			}
+		});
+		client.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type == EventType::Connect) {
+				Packet packet;
+				packet.header.type = Packet::BUNDLE_TYPE;
+				const uint8 payload[8] = {};
+				packet.putdata(payload, sizeof(payload));
+				client.send(packet);
+			}
+		});
+	};
+	CHECK(run_until(std::chrono::seconds(5), step, [&]() { return !received.empty(); }));
+	CHECK(received == std::vector<uint32>{ Packet::BUNDLE_TYPE });
+}
+
+}
+
+int main() {
+	initialize_enet();
+	emit_order();
+	datagram_limit();
+	deinitialize_enet();
+
+	loopback();
+	send_order();
+	plain_bundle_type();
+	return 0;
+}
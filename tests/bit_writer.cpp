@@ -0,0 +1,111 @@
+#include "common.hpp"
+#include "check.hpp"
+
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace scarabnet;
+
+namespace {
+
+std::span<const uint8> payload_of(const Packet& packet) {
+	return { packet.data.data(), packet.data.size() };
+}
+
+// Values of every kind read back within their precision, packed without byte padding
+void round_trip() {
+	std::mt19937 rng(25);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> component(-1.0f, 1.0f);
+
+	Packet packet;
+	BitWriter writer(packet);
+	struct Entry { uint32 bits; bool flag; int32_t entity; float x; std::array<float, 4> rotation; };
+	std::vector<Entry> entries(200);
+	for(Entry& entry : entries) {
+		entry.bits   = rng() & 0x1F;
+		entry.flag   = rng() & 1;
+		entry.entity = (int32_t)(rng() % 1024);
+		entry.x      = position(rng);
+		float length = 0.0f;
+		for(float& value : entry.rotation) {
+			value = component(rng);
+			length += value * value;
+		}
+		for(float& value : entry.rotation) {
+			value /= std::sqrt(length);
+		}
+
+		writer.write_bits(entry.bits, 5).write_bool(entry.flag).write_int(entry.entity, 0, 1023)
+			.write_float(entry.x, -500.0f, 500.0f, 0.01f).write_quaternion(entry.rotation[0], entry.rotation[1], entry.rotation[2], entry.rotation[3]);
+	}
+	CHECK(BitWriter::float_bits(-500.0f, 500.0f, 0.01f) == 17);
+	CHECK(writer.bits() == entries.size() * (5 + 1 + 10 + 17 + 2 + 3 * 10));
+	CHECK(packet.data.size() == (writer.bits() + 7) / 8);
+
+	BitReader reader(payload_of(packet));
+	for(const Entry& entry : entries) {
+		CHECK(reader.read_bits(5) == entry.bits);
+		CHECK(reader.read_bool() == entry.flag);
+		CHECK(reader.read_int(0, 1023) == entry.entity);
+		const std::optional<float> x = reader.read_float(-500.0f, 500.0f, 0.01f);
+		CHECK(x && std::fabs(*x - entry.x) <= 0.01f);
+
+		const std::optional<std::array<float, 4>> rotation = reader.read_quaternion();
+		CHECK(rotation);
+		// q and -q are the same rotation
+		float dot = 0.0f;
+		for(size_t i = 0; i < 4; i++) {
+			dot += (*rotation)[i] * entry.rotation[i];
+		}
+		CHECK(std::fabs(dot) > 0.999f);
+	}
+
+	// Past the last byte
+	CHECK(!reader.read_bits(8));
+	CHECK(!reader.read_bool());
+}
+
+// Out of range values clamp, invalid ranges write nothing instead of misbehaving
+void ranges() {
+	Packet packet;
+	BitWriter writer(packet);
+	writer.write_int(2000, 0, 1023).write_int(-5, 0, 1023).write_float(900.0f, -500.0f, 500.0f, 0.01f);
+	writer.write_int(4, 10, 2).write_float(3.0f, 5.0f, 1.0f, 0.1f).write_float(NAN, 0.0f, 10.0f, 0.1f);
+	writer.write_float(7.5f, 0.0f, 10.0f, 0.0f).write_quantized(1.0f, 0.0f, 1.0f, 32);
+
+	CHECK(BitWriter::float_bits(5.0f, 1.0f, 0.1f) == 0);
+	CHECK(BitWriter::float_bits(NAN, 1.0f, 0.1f) == 0);
+	CHECK(BitWriter::float_bits(0.0f, 10.0f, 0.0f) == 32);
+	CHECK(BitWriter::float_bits(0.0f, 10.0f, -1.0f) == 32);
+	CHECK(BitWriter::float_bits(0.0f, 1e30f, 1e-30f) == 32);
+
+	BitReader reader(payload_of(packet));
+	CHECK(reader.read_int(0, 1023) == 1023);
+	CHECK(reader.read_int(0, 1023) == 0);
+	CHECK(reader.read_float(-500.0f, 500.0f, 0.01f) == 500.0f);
+	CHECK(reader.read_int(10, 2) == 10);
+	CHECK(reader.read_float(5.0f, 1.0f, 0.1f) == 5.0f);
+	CHECK(reader.read_float(0.0f, 10.0f, 0.1f) == 0.0f);
+	CHECK(reader.read_float(0.0f, 10.0f, 0.0f) == 7.5f);
+	CHECK(reader.read_quantized(0.0f, 1.0f, 32) == 1.0f);
+	CHECK(reader);
+
+	// More than 32 bits don't fit the result, even with enough left to read
+	Packet wide;
+	BitWriter(wide).write_bits(UINT32_MAX, 32).write_bits(UINT32_MAX, 32);
+	BitReader too_wide(payload_of(wide));
+	CHECK(!too_wide.read_bits(33));
+	CHECK(!too_wide);
+	CHECK(!too_wide.read_quantized(0.0f, 1.0f, 64));
+}
+
+}
+
+int main() {
+	round_trip();
+	ranges();
+	return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Ends the test with the failed condition and where it is
+#define CHECK(condition) \
+	do { \
+		if(!(condition)) { \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			std::exit(1); \
+		} \
+	} while(0)
+
+// Calls step() until done() returns true or timeout passes, for hosts serviced inline.
+// Returns the last result of done()
+template <typename Step, typename Done>
+inline bool run_until(const std::chrono::milliseconds timeout, Step&& step, Done&& done) {
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while(!done()) {
+		if(std::chrono::steady_clock::now() >= deadline) {
+			return false;
+		}
+		step();
+	}
+	return true;
+}
@@ -0,0 +1,112 @@
+#include "server.hpp"
+#include "client.hpp"
+#include "check.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Random, repetitive and mostly constant inputs of every size up to a few datagrams round trip exactly
+void round_trip() {
+	LZCompressor compressor;
+	std::mt19937 rng(19);
+	for(size_t i = 0; i < 5000; i++) {
+		std::vector<uint8> input(rng() % 3000);
+		const uint32 kind = i % 3;
+		for(uint8& byte : input) {
+			byte = kind == 0 ? (uint8)rng() : kind == 1 ? (uint8)"abcab"[rng() % 5] : (rng() % 50 == 0 ? (uint8)rng() : 'x');
+		}
+
+		std::vector<uint8> compressed(input.size() + 16);
+		const size_t size = compressor.compress(input, compressed);
+		// Only noise may fail to shrink
+		CHECK(size > 0 || kind == 0 || input.size() < 16);
+		if(size == 0) {
+			continue;
+		}
+
+		std::vector<uint8> output(input.size());
+		CHECK(compressor.decompress({ compressed.data(), size }, output) == input.size());
+		CHECK(output == input);
+	}
+}
+
+// Malformed input is rejected, never read or written out of bounds
+void malformed() {
+	LZCompressor compressor;
+	std::mt19937 rng(20);
+	std::vector<uint8> output(4096);
+	for(size_t i = 0; i < 5000; i++) {
+		std::vector<uint8> garbage(rng() % 200);
+		for(uint8& byte : garbage) {
+			byte = (uint8)rng();
+		}
+		CHECK(compressor.decompress(garbage, output) <= output.size());
+	}
+
+	// Doesn't fit in the output
+	const std::string text(1000, 'a');
+	std::vector<uint8> compressed(text.size());
+	const size_t size = compressor.compress({ reinterpret_cast<const uint8*>(text.data()), text.size() }, compressed);
+	CHECK(size > 0);
+	std::vector<uint8> small(text.size() - 1);
+	CHECK(compressor.decompress({ compressed.data(), size }, small) == 0);
+}
+
+// Compressed datagrams are decompressed by the other end before ENet sees them
+void loopback() {
+	HostConfig config;
+	config.network_thread = false;
+	config.compress = true;
+
+	Server server(47019, 4, config);
+	server.start();
+	Client client(config);
+	client.connect("127.0.0.1", 47019);
+
+	std::string message;
+	for(size_t i = 0; i < 20; i++) {
+		message += "{\"player\":\"name\",\"x\":1.0,\"y\":2.0},";
+	}
+
+	constexpr size_t COUNT = 100;
+	size_t received = 0;
+	bool sent = false;
+	auto step = [&]() {
+		server.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type == EventType::Receive && event.packet->unpack_string() == message) {
+				received++;
+			}
+		});
+		client.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			if(event.type != EventType::Connect || sent) {
+				return;
+			}
+			sent = true;
+			for(size_t i = 0; i < COUNT; i++) {
+				Packet packet;
+				packet.putdata(message.data(), message.size());
+				client.send(packet);
+			}
+		});
+	};
+	CHECK(run_until(std::chrono::seconds(5), step, [&]() { return received >= COUNT; }));
+	CHECK(received == COUNT);
+
+	const CompressionStats sent_stats = client.compression_stats();
+	CHECK(sent_stats.compressed > 0);
+	CHECK(sent_stats.bytes_out < sent_stats.bytes_in);
+	CHECK(server.compression_stats().received > 0);
+	CHECK(server.compression_stats().failures == 0);
+}
+
+}
+
+int main() {
+	round_trip();
+	malformed();
+	loopback();
+	return 0;
+}
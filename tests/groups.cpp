@@ -0,0 +1,156 @@
+#include "server.hpp"
+#include "client.hpp"
+#include "check.hpp"
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr uint32 HELLO  = 1;
+constexpr uint32 GROUP  = 2;
+constexpr uint32 MARKER = 3;
+
+Packet make_packet(const uint32 type, const uint32 value) {
+	Packet packet;
+	packet.header.type = type;
+	packet.putdata(&value, sizeof(value));
+	return packet;
+}
+
+uint32 value_of(const Packet& packet) {
+	uint32 value = 0;
+	std::memcpy(&value, packet.data.data(), sizeof(value));
+	return value;
+}
+
+struct Loopback {
+	static constexpr size_t CLIENTS = 3;
+
+	Loopback(const HostConfig& config) : server(47018, 8, config) {
+		this->server.start();
+		for(size_t i = 0; i < CLIENTS; i++) {
+			this->clients[i] = std::make_unique<Client>(config);
+			this->clients[i]->connect("127.0.0.1", 47018);
+		}
+	}
+
+	void step() {
+		this->server.service(std::chrono::milliseconds(1), [&](Event&& event) {
+			// Clients say which one they are, so server ids can be matched to them
+			if(event.type == EventType::Receive && event.packet->header.type == HELLO) {
+				this->ids[value_of(*event.packet)] = event.peer_id;
+			}
+			if(event.type == EventType::Disconnect) {
+				this->disconnects++;
+			}
+		});
+		for(size_t i = 0; i < CLIENTS; i++) {
+			if(!this->clients[i]) {
+				continue;
+			}
+			this->clients[i]->service(std::chrono::milliseconds(0), [&](Event&& event) {
+				if(event.type == EventType::Connect) {
+					this->clients[i]->send(make_packet(HELLO, (uint32)i));
+				}
+				if(event.type == EventType::Receive) {
+					this->received[i].push_back(value_of(*event.packet));
+				}
+			});
+		}
+	}
+
+	// Sends a marker to every connected client and waits for it. Sends on one channel arrive in order,
+	// so a group send queued before it has arrived too, if it was sent at all
+	void sync(const uint32 marker) {
+		for(size_t i = 0; i < CLIENTS; i++) {
+			if(this->clients[i]) {
+				this->server.send(this->ids[i], make_packet(MARKER, marker));
+			}
+		}
+		const bool synced = run_until(std::chrono::seconds(5), [&]() { this->step(); }, [&]() {
+			for(size_t i = 0; i < CLIENTS; i++) {
+				if(this->clients[i] && (this->received[i].empty() || this->received[i].back() != marker)) {
+					return false;
+				}
+			}
+			return true;
+		});
+		CHECK(synced);
+	}
+
+	// Values received by client i since the last call, markers left out
+	std::vector<uint32> take(const size_t i) {
+		std::vector<uint32> values;
+		for(const uint32 value : this->received[i]) {
+			if(value < 1000) {
+				values.push_back(value);
+			}
+		}
+		this->received[i].clear();
+		return values;
+	}
+
+	Server server;
+	std::array<std::unique_ptr<Client>, CLIENTS> clients;
+	std::array<uint32, CLIENTS> ids = {};
+	std::array<std::vector<uint32>, CLIENTS> received;
+	size_t disconnects = 0;
+};
+
+}
+
+int main() {
+	HostConfig config;
+	config.network_thread = false;
+	Loopback loop(config);
+
+	CHECK(run_until(std::chrono::seconds(5), [&]() { loop.step(); }, [&]() {
+		return loop.ids[0] != 0 && loop.ids[1] != 0 && loop.ids[2] != 0;
+	}));
+
+	// Group sends reach every member but the excluded one
+	const uint32 group = loop.server.create_group();
+	for(const uint32 id : loop.ids) {
+		loop.server.join(group, id);
+	}
+	loop.server.send_group(group, make_packet(GROUP, 1), PacketFlag::RELIABLE, 0, loop.ids[0]);
+	loop.sync(1000);
+	CHECK(loop.take(0).empty());
+	CHECK(loop.take(1) == std::vector<uint32>{ 1 });
+	CHECK(loop.take(2) == std::vector<uint32>{ 1 });
+
+	// A client that left gets nothing
+	loop.server.leave(group, loop.ids[1]);
+	loop.server.send_group(group, make_packet(GROUP, 2));
+	loop.sync(1001);
+	CHECK(loop.take(0) == std::vector<uint32>{ 2 });
+	CHECK(loop.take(1).empty());
+	CHECK(loop.take(2) == std::vector<uint32>{ 2 });
+
+	// Joining a group that was never created doesn't create it
+	loop.server.join(group + 100, loop.ids[1]);
+	loop.server.send_group(group + 100, make_packet(GROUP, 3));
+	loop.sync(1002);
+	CHECK(loop.take(1).empty());
+
+	// A disconnected client leaves its groups, the rest still get group sends
+	loop.clients[2]->disconnect();
+	CHECK(run_until(std::chrono::seconds(5), [&]() { loop.step(); }, [&]() { return loop.disconnects == 1; }));
+	loop.clients[2].reset();
+	loop.server.send_group(group, make_packet(GROUP, 4));
+	loop.sync(1003);
+	CHECK(loop.take(0) == std::vector<uint32>{ 4 });
+	CHECK(loop.take(1).empty());
+
+	// A destroyed group can't be joined again
+	loop.server.destroy_group(group);
+	loop.server.join(group, loop.ids[0]);
+	loop.server.send_group(group, make_packet(GROUP, 5));
+	loop.sync(1004);
+	CHECK(loop.take(0).empty());
+	CHECK(loop.take(1).empty());
+	return 0;
+}
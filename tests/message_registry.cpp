@@ -0,0 +1,72 @@
+#include "common.hpp"
+#include "check.hpp"
+
+using namespace scarabnet;
+
+namespace {
+
+struct Move { float x, y; };
+struct Chat { char text[16]; };
+struct Ping { uint32 time; };
+
+using Messages = MessageRegistry<Message<Move, 1>, Message<Chat, 2>, Message<Ping, 9>>;
+
+static_assert(Messages::type_of<Chat>() == 2);
+static_assert(Messages::MAX_TYPE == 9);
+static_assert(!Messages::contains<int>());
+
+struct Handler {
+	void operator()(const uint32, const Move& move) {
+		this->moves++;
+		this->last_move = move;
+	}
+	void operator()(const uint32, const Chat&) {
+		this->chats++;
+	}
+	void operator()(const uint32 peer_id, const Ping& ping) {
+		this->pings++;
+		this->last_peer = peer_id;
+		this->last_ping = ping.time;
+	}
+
+	int moves = 0, chats = 0, pings = 0;
+	Move last_move = {};
+	uint32 last_peer = 0, last_ping = 0;
+};
+
+}
+
+// Registered messages encode and dispatch to their overload, anything else is rejected
+int main() {
+	Handler handler;
+
+	const Packet move = Messages::make_packet(Move { 1.0f, 2.0f });
+	CHECK(move.header.type == 1);
+	CHECK(Messages::dispatch(handler, 0, move.header, move.data));
+	CHECK(handler.moves == 1 && handler.last_move.x == 1.0f && handler.last_move.y == 2.0f);
+
+	const Packet ping = Messages::make_packet(Ping { 77 });
+	CHECK(Messages::dispatch(handler, 5, ping.header, ping.data));
+	CHECK(handler.pings == 1 && handler.last_peer == 5 && handler.last_ping == 77);
+
+	// Straight from a received event
+	Event event { .peer_id = 6, .type = EventType::Receive };
+	const auto buffer = PacketHelper::serialize_packet(ping);
+	event.packet = PacketHelper::deserialize_packet(buffer.data(), buffer.size());
+	CHECK(Messages::dispatch(handler, event));
+	CHECK(handler.pings == 2 && handler.last_peer == 6);
+	CHECK(!Messages::dispatch(handler, Event {}));
+
+	// Unregistered types, types past the table and payloads of the wrong size
+	CHECK(!Messages::dispatch(handler, 0, Packet::Header { 0, 5 }, move.data));
+	CHECK(!Messages::dispatch(handler, 0, Packet::Header { 0, 1000 }, move.data));
+	CHECK(!Messages::dispatch(handler, 0, Packet::Header { 0, 2 }, move.data));
+	CHECK(handler.chats == 0);
+
+	CHECK(Messages::decode<Move>(move.header, move.data)->y == 2.0f);
+	CHECK(!Messages::decode<Chat>(move.header, move.data));
+
+	PacketBuilder builder = Messages::make_builder(Chat { "hi" });
+	CHECK(builder && builder.size() == sizeof(Packet::Header) + sizeof(Chat));
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include "common.hpp"
+#include "check.hpp"
+
+#include <algorithm>
+#include <string>
+
+using namespace scarabnet;
+
+// Payloads move between inline and heap storage without losing bytes
+int main() {
+	Packet packet;
+	const int value = 42;
+	packet.putdata(&value, sizeof(value));
+	CHECK(packet.data.is_inline());
+	CHECK(packet.unpack_data<int>() == 42);
+
+	// Past the inline size it moves to the heap
+	const std::string big(SCARABNET_PACKET_INLINE_SIZE + 100, 'x');
+	packet.putdata(big.data(), big.size());
+	CHECK(!packet.data.is_inline());
+	CHECK(packet.unpack_string() == big);
+
+	// Copies and moves keep the bytes, a moved from payload is empty
+	Packet copy = packet;
+	CHECK(copy.unpack_string() == big);
+	Packet moved = std::move(copy);
+	CHECK(moved.unpack_string() == big);
+	CHECK(copy.data.empty());
+
+	Packet small;
+	small.putdata("hello", 5);
+	Packet small_moved = std::move(small);
+	CHECK(small_moved.unpack_string() == "hello");
+
+	// Shrinking keeps the heap capacity for reuse
+	packet.putdata("ab", 2);
+	CHECK(packet.unpack_string() == "ab");
+	CHECK(packet.data.capacity() >= big.size());
+
+	// Growing zero fills
+	small_moved = moved;
+	small_moved.data.push_back(1);
+	small_moved.data.resize(big.size() + 100);
+	CHECK(small_moved.data[big.size()] == 1);
+	CHECK(small_moved.data[big.size() + 99] == 0);
+
+	// Serialized and back, as received packets are
+	const auto buffer = PacketHelper::serialize_packet(small_moved);
+	const PacketPtr received = PacketHelper::deserialize_packet(buffer.data(), buffer.size());
+	CHECK(received && received->data.size() == small_moved.data.size());
+	CHECK(std::equal(received->data.begin(), received->data.end(), small_moved.data.begin()));
+	return 0;
+}
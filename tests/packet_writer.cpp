@@ -0,0 +1,107 @@
+#include "common.hpp"
+#include "check.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace scarabnet;
+
+namespace {
+
+std::span<const uint8> payload_of(const Packet& packet) {
+	return { packet.data.data(), packet.data.size() };
+}
+
+// Every field type reads back as written, in order
+void round_trip() {
+	Packet packet;
+	PacketWriter writer(packet);
+	const std::string big(500, 'z');
+	const std::vector<uint8> bytes = { 1, 2, 3 };
+	writer.write<uint32>(7).write<float>(1.5f)
+		.write_varint(0).write_varint(127).write_varint(128).write_varint(300).write_varint(UINT64_MAX)
+		.write_varint_signed(-3).write_varint_signed(INT64_MIN).write_varint_signed(INT64_MAX)
+		.write_string("hello").write_bytes(bytes).write_string(big).write_raw("end", 3);
+
+	PacketReader reader(payload_of(packet));
+	CHECK(reader.read<uint32>() == 7u);
+	CHECK(reader.read<float>() == 1.5f);
+	CHECK(reader.read_varint() == 0u);
+	CHECK(reader.read_varint() == 127u);
+	CHECK(reader.read_varint() == 128u);
+	CHECK(reader.read_varint() == 300u);
+	CHECK(reader.read_varint() == UINT64_MAX);
+	CHECK(reader.read_varint_signed() == -3);
+	CHECK(reader.read_varint_signed() == INT64_MIN);
+	CHECK(reader.read_varint_signed() == INT64_MAX);
+	CHECK(reader.read_string() == "hello");
+	const std::optional<std::span<const uint8>> read_bytes = reader.read_bytes();
+	CHECK(read_bytes && std::vector<uint8>(read_bytes->begin(), read_bytes->end()) == bytes);
+	CHECK(reader.read_string() == big);
+	const std::optional<std::span<const uint8>> raw = reader.read_raw(3);
+	CHECK(raw && std::memcmp(raw->data(), "end", 3) == 0);
+	CHECK(reader.remaining() == 0 && reader);
+
+	// Reading past the end fails every read after it
+	CHECK(!reader.read<uint8>());
+	CHECK(!reader);
+	CHECK(!reader.read_varint());
+}
+
+// Varints of every length round trip, and sizes match LEB128
+void varints() {
+	std::mt19937_64 rng(23);
+	for(uint32 bits = 0; bits <= 64; bits++) {
+		const uint64_t value = bits == 0 ? 0 : (bits == 64 ? rng() | (1ull << 63) : (rng() & ((1ull << bits) - 1)) | (1ull << (bits - 1)));
+		Packet packet;
+		PacketWriter writer(packet);
+		writer.write_varint(value);
+		CHECK(writer.size() == std::max<size_t>(1, (bits + 6) / 7));
+
+		PacketReader reader(payload_of(packet));
+		CHECK(reader.read_varint() == value);
+		CHECK(reader.remaining() == 0);
+	}
+}
+
+// Truncated and overlong varints are rejected instead of misread
+void malformed() {
+	const uint8 overflow[10] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x02 };
+	PacketReader overflowing(overflow);
+	CHECK(!overflowing.read_varint());
+
+	const uint8 overlong[11] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 };
+	PacketReader too_long(overlong);
+	CHECK(!too_long.read_varint());
+
+	const uint8 truncated[2] = { 0x80, 0x80 };
+	PacketReader cut(truncated);
+	CHECK(!cut.read_varint());
+
+	// A string whose length runs past the payload leaves the cursor where it was
+	Packet packet;
+	PacketWriter(packet).write<uint32>(1).write_string("hello");
+	PacketReader reader(payload_of(packet).first(packet.data.size() - 1));
+	CHECK(reader.read<uint32>() == 1u);
+	const size_t position = reader.position();
+	CHECK(!reader.read_string());
+	CHECK(reader.position() == position);
+
+	// Every prefix of a message fails cleanly
+	for(size_t size = 0; size < packet.data.size(); size++) {
+		PacketReader prefix(payload_of(packet).first(size));
+		prefix.read<uint32>();
+		prefix.read_string();
+		CHECK(!prefix);
+	}
+}
+
+}
+
+int main() {
+	round_trip();
+	varints();
+	malformed();
+	return 0;
+}